@@ -3,9 +3,50 @@
  * Ian Kaufman PA1
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for the mmap() flags beyond POSIX
+#endif
+
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h> // for perror()
+#include <stdint.h> // for uintptr_t
+#include <string.h> // for memset()
+#include <stdatomic.h> // for the pool store
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h> // for mmap()
+#include <unistd.h> // for sysconf()
+#include <fcntl.h> // for open()
+#include <sys/stat.h> // for fstat()
+#include <sched.h> // for sched_yield()
+#include <errno.h>
+#include <pthread.h> // for the process-shared lock
+#include <time.h> // for clock_gettime()
+#define MEM_HAVE_MMAP
+#define MEM_HAVE_PTHREADS
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h> // for mbind(), which libc does not wrap
+#endif
+#define MEM_NUMA_MAX_NODES 1024 // size of the mbind() node mask
+#define MEM_POOL_STORE_CHUNKS 32 // chunks of the pool store, each twice the previous one
+#define MEM_NODE_HEAP_CHUNKS 32 // chunks of a node heap, each twice the previous one
+#define MEM_THREAD_CACHE_POOLS 4 // pools a thread caches blocks for
+#define MEM_THREAD_CACHE_BINS 8 // sizes a thread caches per pool
+#define MEM_THREAD_CACHE_DEPTH 16 // blocks a thread caches per size
+
+// note: a seqlock reader races with the writers by design, and retries on a torn read,
+//       so the race detector is told to leave it alone
+#if defined(__has_attribute)
+#if __has_attribute(no_sanitize)
+#define MEM_SEQLOCK_READER __attribute__((no_sanitize("thread")))
+#endif
+#endif
+#ifndef MEM_SEQLOCK_READER
+#define MEM_SEQLOCK_READER
+#endif
 
 #include "mem_pool.h"
 
@@ -18,7 +59,6 @@ static const float      MEM_FILL_FACTOR                 = 0.75;
 static const unsigned   MEM_EXPAND_FACTOR               = 2;
 
 static const unsigned   MEM_POOL_STORE_INIT_CAPACITY    = 20;
-static const float      MEM_POOL_STORE_FILL_FACTOR      = 0.75;
 static const unsigned   MEM_POOL_STORE_EXPAND_FACTOR    = 2;
 
 static const unsigned   MEM_NODE_HEAP_INIT_CAPACITY     = 40;
@@ -29,6 +69,31 @@ static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
 static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 
+static const unsigned   MEM_REGIONS_INIT_CAPACITY       = 4;
+static const unsigned   MEM_REGIONS_EXPAND_FACTOR       = 2;
+static const unsigned   MEM_POOL_GROW_FACTOR            = 2;
+
+static const size_t     MEM_HUGE_PAGE_SIZE              = 2 * 1024 * 1024;
+
+static const size_t     MEM_FILE_HEADER_SIZE            = 4096;
+static const char       MEM_FILE_MAGIC[8]               = "MEMPOOL";
+
+static const char       MEM_SHARED_MAGIC[8]             = "MEMSHRD";
+static const unsigned   MEM_SHARED_SEGMENTS             = 4096;
+static const unsigned   MEM_SHARED_ATTACH_SPINS         = 1000000;
+
+static const unsigned   MEM_THREAD_CACHE_BATCH          = MEM_THREAD_CACHE_DEPTH / 2;
+
+static const size_t     MEM_SLAB_ALIGNMENT              = 16; // objects are aligned for any type
+static const size_t     MEM_SLAB_REGION_ALIGNMENT       = 64; // a cache line
+static const uint32_t   MEM_SLAB_NIL                    = UINT32_MAX; // end of the free list
+
+static const int        MEM_NUMA_NONE                   = -2;
+static const size_t     MEM_SHARD_ALIGNMENT             = 64;
+static const char       MEM_NUMA_ONLINE_PATH[]          = "/sys/devices/system/node/online";
+static const int        MEM_NUMA_MPOL_BIND              = 2;
+static const int        MEM_NUMA_MPOL_INTERLEAVE        = 3;
+
 
 
 /*********************/
@@ -40,23 +105,126 @@ typedef struct _node {
     alloc_t alloc_record;
     unsigned used;
     unsigned allocated;
+    unsigned pending; // freed, but not yet coalesced or in the gap index
+    unsigned cached; // freed into a thread's cache, but still allocated in the pool
     struct _node *next, *prev; // doubly-linked list for gap deletion
+    atomic_uint remote; // freed by another thread, and waiting in the shard's remote free queue
+    _Atomic(struct _node *) remote_next;
 } node_t, *node_pt;
 
+typedef _Atomic(struct _pool_mgr *) pool_slot_t, *pool_slot_pt;
+
 typedef struct _gap {
     size_t size;
     node_pt node;
 } gap_t, *gap_pt;
 
+typedef struct _region {
+    char *mem;
+    size_t size;
+    pool_backing backing;
+    size_t zero_top; // region offset from which memory has never been handed out
+} region_t, *region_pt;
+
 typedef struct _pool_mgr {
     pool_t pool;
-    node_pt node_heap;
+    node_pt node_heap; // the first chunk, whose first node heads the list
+    _Atomic(node_pt) node_chunks[MEM_NODE_HEAP_CHUNKS]; // chunk k has INIT * EXPAND^k nodes
+    unsigned num_chunks;
     unsigned total_nodes;
     unsigned used_nodes;
     gap_pt gap_ix;
     unsigned gap_ix_capacity;
+    pool_backing backing;
+    unsigned flags;
+    size_t zero_top; // pool offset from which memory has never been handed out
+    size_t last_dirty; // bytes of the latest allocation that may not be zero
+    region_pt regions; // all the regions of a growable pool, the first one is pool.mem
+    unsigned num_regions;
+    unsigned regions_capacity;
+    node_pt *pending_q; // deferred frees, coalesced in bulk
+    unsigned pending_count;
+    unsigned pending_threshold; // 0 if frees are not deferred
+    size_t class_quantum; // size class step for small sizes, 0 if sizes are not rounded
+    size_t class_small_max;
+    unsigned class_steps; // size classes per doubling above class_small_max
+    size_t trim_threshold; // gaps this large give their pages back, 0 if never
+    int file_fd; // backing file of a persistent or shared pool
+    int numa_node; // node the pool is bound to, MEM_NUMA_INTERLEAVE, or MEM_NUMA_NONE
+    unsigned store_ix; // slot in the pool store
+    atomic_int spin; // the lock of a POOL_LOCK_SPIN pool
+    atomic_uint seq; // odd while a thread holds the lock of a locked pool
+#ifdef MEM_HAVE_PTHREADS
+    pthread_mutex_t mutex; // the lock of a POOL_LOCK_MUTEX pool
+#endif
+    struct _pool_shared_header *shared; // metadata of a shared pool, in the shared mapping
+    struct _pool_mgr **shards; // sub-pools of a sharded pool, NULL if not sharded
+    unsigned num_shards;
+    size_t shard_size; // of all shards but the last, which takes the remainder
+    unsigned striped; // shards are taken by whether they are locked, not by thread
+    _Atomic(node_pt) remote_q; // frees from other threads, drained by the shard's own threads
+    atomic_size_t largest_gap; // of a locked pool, as of the last unlock, for sibling shards to read
+    atomic_int maintained; // a locked pool the maintenance thread visits
+    unsigned trim_due; // gaps over the trim threshold were left for the maintenance thread
 } pool_mgr_t, *pool_mgr_pt;
 
+// note: persistent pools store offsets only, so the file can be mapped anywhere
+typedef struct _pool_file_header {
+    char magic[8];
+    uint64_t total_size;
+    uint64_t policy;
+    uint64_t zero_top;
+    uint64_t num_segments; // the segment table follows the pool in the file
+} pool_file_header_t;
+
+typedef struct _pool_file_segment {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t allocated;
+} pool_file_segment_t, *pool_file_segment_pt;
+
+#ifdef MEM_HAVE_MMAP
+// note: a shared pool keeps all of its metadata in the mapping, as offsets,
+//       followed by a segment table sorted by offset, and then the pool itself
+typedef struct _pool_shared_header {
+    char magic[8]; // written last, so attaching processes wait for it
+    uint64_t total_size;
+    uint64_t policy;
+    uint64_t meta_size; // header and segment table, whole pages
+    uint64_t capacity; // of the segment table
+    uint64_t num_segments;
+    uint64_t num_allocs;
+    uint64_t alloc_size;
+    uint64_t num_gaps;
+    pthread_mutex_t lock;
+} pool_shared_header_t, *pool_shared_header_pt;
+#endif
+
+
+
+// note: a cached block is still an allocation as far as the pool is concerned
+typedef struct _thread_cache {
+    pool_mgr_pt pool_mgr; // NULL if the entry is free
+    unsigned store_ix; // tells apart pools opened at the same address
+    size_t sizes[MEM_THREAD_CACHE_BINS];
+    unsigned counts[MEM_THREAD_CACHE_BINS]; // a bin with no blocks is free
+    node_pt blocks[MEM_THREAD_CACHE_BINS][MEM_THREAD_CACHE_DEPTH];
+} thread_cache_t, *thread_cache_pt;
+
+
+
+// note: the free list is a stack of object indices with the head tagged by a counter,
+//       so a pop that raced with a pop and a push of the same object fails its CAS
+typedef struct _slab {
+    _Atomic uint64_t head; // tag << 32 | index of the first free object
+    char *mem; // the region carved from the pool
+    alloc_pt alloc; // its allocation record, which never moves
+    pool_pt pool;
+    size_t object_size;
+    unsigned num_objects;
+    _Atomic uint32_t *next; // free list links, by object index
+} slab_t;
+
 
 
 /***************************/
@@ -64,9 +232,23 @@ typedef struct _pool_mgr {
 /* Static global variables */
 /*                         */
 /***************************/
-static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
-static unsigned pool_store_size = 0;
-static unsigned pool_store_capacity = 0;
+// note: the store is a list of chunks of slots, which never move once allocated,
+//       so a slot can be claimed, read, and cleared without a lock
+static _Atomic(pool_slot_pt) pool_store[MEM_POOL_STORE_CHUNKS]; // chunk k has INIT * EXPAND^k slots
+static atomic_uint pool_store_size = 0; // slots claimed so far, only grows
+static _Thread_local thread_cache_t thread_caches[MEM_THREAD_CACHE_POOLS]; // for POOL_THREAD_CACHE pools
+static _Thread_local unsigned thread_shard = 0; // 1 + the thread's shard number, 0 until assigned
+static atomic_uint shard_next = 0; // shard numbers handed out to threads so far
+static atomic_int maint_running = 0; // 1 while the maintenance thread runs
+#ifdef MEM_HAVE_PTHREADS
+// note: the maintenance mutex only guards the thread's sleep, opening and closing a pool
+//       never take it, and a pool's mgr is not freed while the pass is visiting it
+static pthread_mutex_t maint_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maint_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t maint_thread;
+static unsigned maint_interval_ms = 0;
+static _Atomic(pool_mgr_pt) maint_visiting = NULL; // the pool a pass is in, or about to enter
+#endif
 
 
 
@@ -75,9 +257,46 @@ static unsigned pool_store_capacity = 0;
 /* Forward declarations of static functions */
 /*                                          */
 /********************************************/
-static alloc_status _mem_resize_pool_store();
+static pool_slot_pt _mem_pool_store_slot(unsigned ix, int create);
+static pool_pt
+        _mem_open_pool(size_t size,
+                       alloc_policy policy,
+                       unsigned flags,
+                       int node);
+static char *_mem_map_region(size_t size, unsigned flags, pool_backing *backing);
+static void _mem_unmap_region(char *mem, size_t size, pool_backing backing);
+static alloc_status _mem_warm_region(char *mem, size_t size, unsigned flags);
+static void _mem_trim_gap(pool_mgr_pt pool_mgr, node_pt node);
+static pool_mgr_pt
+        _mem_open_mgr(char *mem,
+                      size_t size,
+                      alloc_policy policy,
+                      pool_backing backing);
+static void _mem_close_mgr(pool_mgr_pt pool_mgr);
+static alloc_status _mem_extend_pool(pool_mgr_pt pool_mgr, size_t min_size);
+static alloc_status _mem_grow_pool(pool_mgr_pt pool_mgr, size_t min_size);
+static alloc_status _mem_remap_pool(pool_mgr_pt pool_mgr, size_t min_size);
+static region_pt _mem_find_region(pool_mgr_pt pool_mgr, char *mem);
+static void _mem_numa_bind(char *mem, size_t size, int node);
+#ifdef MEM_HAVE_MMAP
+static alloc_status _mem_file_sync(pool_mgr_pt pool_mgr);
+static int _mem_file_unsynced(int fd, off_t file_size);
+static alloc_status _mem_shared_lock(pool_mgr_pt pool_mgr);
+static void _mem_shared_unlock(pool_mgr_pt pool_mgr);
+static alloc_status
+        _mem_check_segments(const pool_file_segment_t *segs,
+                            uint64_t num_segs,
+                            uint64_t total_size);
+static alloc_status
+        _mem_file_restore(pool_mgr_pt pool_mgr,
+                          const pool_file_header_t *header);
+#endif
 static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr);
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr);
+static alloc_status _mem_expand_node_heap(pool_mgr_pt pool_mgr, unsigned capacity);
+static alloc_status _mem_expand_gap_ix(pool_mgr_pt pool_mgr, unsigned capacity);
+static node_pt _mem_node_at(pool_mgr_pt pool_mgr, unsigned ix);
+static int _mem_owns_node(pool_mgr_pt pool_mgr, node_pt node);
 static alloc_status
         _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
                            size_t size,
@@ -87,6 +306,62 @@ static alloc_status
                                 size_t size,
                                 node_pt node);
 static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
+static node_pt _mem_get_unused_node(pool_mgr_pt pool_mgr);
+static alloc_pt
+        _mem_new_alloc(pool_mgr_pt pool_mgr,
+                       size_t size,
+                       size_t alignment);
+static alloc_pt
+        _mem_new_alloc_near(pool_mgr_pt pool_mgr,
+                            size_t size,
+                            node_pt hint_node);
+static alloc_status _mem_del_alloc(pool_mgr_pt pool_mgr, node_pt del_node);
+static inline void _mem_lock(pool_mgr_pt pool_mgr);
+static inline void _mem_unlock(pool_mgr_pt pool_mgr);
+static inline void _mem_seq_begin(pool_mgr_pt pool_mgr);
+static inline int _mem_trylock(pool_mgr_pt pool_mgr);
+static void _mem_maint_set(pool_mgr_pt pool_mgr, int on);
+static void _mem_maint_wait(pool_mgr_pt pool_mgr);
+static void _mem_maintain(pool_mgr_pt pool_mgr);
+#ifdef MEM_HAVE_PTHREADS
+static void *_mem_maint_main(void *arg);
+#endif
+static node_pt
+        _mem_find_gap(pool_mgr_pt pool_mgr,
+                      size_t size,
+                      size_t alignment,
+                      size_t *pad);
+static alloc_pt
+        _mem_carve_gap(pool_mgr_pt pool_mgr,
+                       node_pt gap_node,
+                       size_t pad,
+                       size_t size);
+static alloc_status _mem_coalesce_gap(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_flush_pending(pool_mgr_pt pool_mgr);
+static void _mem_drain_remote(pool_mgr_pt pool_mgr);
+static alloc_status
+        _mem_snapshot_mgr(pool_mgr_pt pool_mgr,
+                          pool_t *stats,
+                          pool_segment_pt *segments,
+                          unsigned *num_segments);
+static alloc_pt
+        _mem_reuse_pending(pool_mgr_pt pool_mgr,
+                           size_t size,
+                           size_t alignment);
+static size_t _mem_round_size(pool_mgr_pt pool_mgr, size_t size);
+static thread_cache_pt _mem_thread_cache(pool_mgr_pt pool_mgr, int create);
+static int _mem_thread_cache_bin(thread_cache_pt cache, size_t size, int create);
+static void _mem_thread_cache_drain(thread_cache_pt cache, int bin, unsigned count);
+static pool_mgr_pt _mem_shard_for_thread(pool_mgr_pt pool_mgr);
+static pool_mgr_pt _mem_shard_for_mem(pool_mgr_pt pool_mgr, char *mem);
+static pool_mgr_pt
+        _mem_shard_victim(pool_mgr_pt pool_mgr,
+                          pool_mgr_pt home,
+                          size_t size);
+static node_pt
+        _mem_find_gap_near(node_pt hint_node,
+                           size_t size,
+                           size_t *pad);
 
 
 
@@ -97,33 +372,61 @@ static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
 /****************************************/
 alloc_status mem_init() {
     // ensure that it's called only once until mem_free
-    // allocate the pool store with initial capacity
+    // allocate the first chunk of the pool store
     // note: holds pointers only, other functions to allocate/deallocate
-    if (pool_store) {
+    // note: mem_init and mem_free are not to race with anything else
+    if (atomic_load(&pool_store[0])) {
         return ALLOC_CALLED_AGAIN;
     }
     else {
-        pool_mgr_pt* store = (pool_mgr_pt*) calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(pool_mgr_pt));
-        assert(store);
-        pool_store_size = 0;
-        pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
-        pool_store = store;
+        atomic_store(&pool_store_size, 0);
+        return (_mem_pool_store_slot(0, 1)) ? ALLOC_OK : ALLOC_FAIL;
+    }
+}
+
+alloc_status mem_init_ex(unsigned maintenance_ms) {
+    alloc_status status = mem_init();
+    if ((status != ALLOC_OK) || (maintenance_ms == 0)) {
+        return status;
+    }
+#ifdef MEM_HAVE_PTHREADS
+    // start the maintenance thread
+    maint_interval_ms = maintenance_ms;
+    atomic_store(&maint_running, 1);
+    if (pthread_create(&maint_thread, NULL, _mem_maint_main, NULL) == 0) {
         return ALLOC_OK;
     }
+    atomic_store(&maint_running, 0);
+#endif
+    mem_free();
+
+    return ALLOC_FAIL;
 }
 
 alloc_status mem_free() {
     // ensure that it's called only once for each mem_init
-    if (pool_store) {
-        for (int i = 0; i < pool_store_size; i++) {
-            if(pool_store[i] != NULL) {
+    if (atomic_load(&pool_store[0])) {
+        unsigned size = atomic_load(&pool_store_size);
+        for (unsigned u = 0; u < size; u++) {
+            pool_slot_pt slot = _mem_pool_store_slot(u, 0);
+            if ((slot != NULL) && (atomic_load(slot) != NULL)) {
                 return ALLOC_CALLED_AGAIN;
             }
         }
-        free(pool_store);
-        pool_store = NULL;
-        pool_store_size = 0;
-        pool_store_capacity = 0;
+#ifdef MEM_HAVE_PTHREADS
+        // stop the maintenance thread, if any, before the store goes
+        if (atomic_load(&maint_running)) {
+            pthread_mutex_lock(&maint_mutex);
+            atomic_store(&maint_running, 0);
+            pthread_cond_signal(&maint_cond);
+            pthread_mutex_unlock(&maint_mutex);
+            pthread_join(maint_thread, NULL);
+        }
+#endif
+        for (unsigned chunk = 0; chunk < MEM_POOL_STORE_CHUNKS; chunk++) {
+            free(atomic_exchange(&pool_store[chunk], NULL));
+        }
+        atomic_store(&pool_store_size, 0);
         return ALLOC_OK;
     }
     // make sure all pool managers have been deallocated
@@ -134,68 +437,145 @@ alloc_status mem_free() {
 }
 
 pool_pt mem_pool_open(size_t size, alloc_policy policy) {
+    // a plain pool on the heap
+    return mem_pool_open_ex(size, policy, POOL_DEFAULT);
+}
+
+pool_pt mem_pool_open_ex(size_t size, alloc_policy policy, unsigned flags) {
+    // a pool that is not bound to a NUMA node
+    return _mem_open_pool(size, policy, flags, MEM_NUMA_NONE);
+}
+
+pool_pt mem_pool_open_numa(size_t size, alloc_policy policy, unsigned flags, int node) {
+    // the pages have to be mapped to be placed
+    return _mem_open_pool(size, policy, flags | POOL_MMAP, node);
+}
+
+alloc_status mem_pool_open_per_node(size_t size,
+                                    alloc_policy policy,
+                                    unsigned flags,
+                                    pool_pt *pools[],
+                                    unsigned *num_pools) {
+    unsigned nodes = mem_numa_nodes();
+    // allocate the pools array with size == nodes
+    pool_pt *node_pools = (pool_pt *) calloc(nodes, sizeof(pool_pt));
+    if (node_pools == NULL) {
+        return ALLOC_FAIL;
+    }
+    // open a pool on each node, undo it all on error
+    for (unsigned u = 0; u < nodes; u++) {
+        node_pools[u] = mem_pool_open_numa(size, policy, flags, (int) u);
+        if (node_pools[u] == NULL) {
+            while (u > 0) {
+                mem_pool_close(node_pools[--u]);
+            }
+            free(node_pools);
+            return ALLOC_FAIL;
+        }
+    }
+
+    *pools = node_pools;
+    *num_pools = nodes;
+
+    return ALLOC_OK;
+}
+
+unsigned mem_numa_nodes() {
+    // the online nodes read like "0" or "0-3" or "0,2-3", so the last number is the highest node
+    unsigned nodes = 1;
+    FILE *online = fopen(MEM_NUMA_ONLINE_PATH, "r");
+    if (online == NULL) {
+        return nodes;
+    }
+    char line[256];
+    if (fgets(line, sizeof(line), online)) {
+        char *last = line;
+        for (char *c = line; *c; c++) {
+            if ((*c == '-') || (*c == ',')) {
+                last = c + 1;
+            }
+        }
+        unsigned long highest = strtoul(last, NULL, 10);
+        if (highest < MEM_NUMA_MAX_NODES) {
+            nodes = (unsigned) highest + 1;
+        }
+    }
+    fclose(online);
+
+    return nodes;
+}
+
+pool_pt mem_pool_open_external(char *mem, size_t size, alloc_policy policy) {
     // make sure there the pool store is allocated
-    assert(pool_store);
-    // expand the pool store, if necessary
-    _mem_resize_pool_store();
-    // allocate a new mem pool mgr
-    pool_mgr_pt mgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
-    // check success, on error return null
+    assert(atomic_load(&pool_store[0]));
+    // check there is a buffer to manage
+    if ((mem == NULL) || (size == 0)) {
+        return NULL;
+    }
+    // set up the pool mgr over the caller's buffer
+    pool_mgr_pt mgr = _mem_open_mgr(mem, size, policy, POOL_BACKING_EXTERNAL);
     if (mgr == NULL) {
         return NULL;
     }
-    // allocate a new memory pool
-    char* new_pool = (char*) calloc(size, sizeof(char));
-    // check success, on error deallocate mgr and return null
-    if (new_pool == NULL) {
-        free(mgr);
+    // the buffer may hold anything, so none of it is known to be zero
+    mgr->zero_top = size;
+
+    return (pool_pt) mgr;
+}
+
+pool_pt mem_pool_open_sharded(size_t size, alloc_policy policy, unsigned num_shards) {
+    // every shard needs a cache line of its own at least
+    if ((num_shards == 0) || (size / num_shards < MEM_SHARD_ALIGNMENT)) {
         return NULL;
     }
-    // allocate a new node heap
-    node_pt new_heap = (node_pt) calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(node_t));
-    // check success, on error deallocate mgr/pool and return null
-    if (new_heap == NULL) {
-        free(new_pool);
-        free(mgr);
+    // map the whole pool in one go, so the shards are slices of one region
+    pool_pt pool = mem_pool_open_ex(size, policy, POOL_MMAP);
+    if (pool == NULL) {
         return NULL;
     }
-    // allocate a new gap index
-    gap_pt new_ix = (gap_pt) calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
-    // check success, on error deallocate mgr/pool/heap and return null
-    if (new_ix == NULL) {
-        free(new_heap);
-        free(new_pool);
-        free(mgr);
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    mgr->shards = (pool_mgr_pt *) calloc(num_shards, sizeof(pool_mgr_pt));
+    if (mgr->shards == NULL) {
+        mem_pool_close(pool);
+        return NULL;
     }
-    // assign all the pointers and update meta data:
-    mgr->pool.mem = new_pool;
-    mgr->pool.total_size = size;
-    mgr->pool.num_allocs = 0;
-    mgr->pool.alloc_size = 0;
-    mgr->pool.num_gaps = 1;
-    mgr->pool.policy = policy;
+    // slices start on cache lines, so no two shards write to the same line
+    mgr->shard_size = (size / num_shards) & ~(MEM_SHARD_ALIGNMENT - 1);
+    for (unsigned u = 0; u < num_shards; u++) {
+        size_t offset = u * mgr->shard_size;
+        size_t shard_size = (u == num_shards - 1) ? (size - offset) : mgr->shard_size;
+        pool_mgr_pt shard = (pool_mgr_pt) mem_pool_open_external(pool->mem + offset, shard_size, policy);
+        if (shard == NULL) {
+            for (unsigned v = 0; v < u; v++) {
+                _mem_close_mgr(mgr->shards[v]);
+            }
+            free(mgr->shards);
+            mgr->shards = NULL;
+            mem_pool_close(pool);
+            return NULL;
+        }
+        //   the slice is part of the parent's fresh region, and only ever locked on its own
+        shard->backing = mgr->backing;
+        shard->zero_top = 0;
+        shard->flags = POOL_LOCK_SPIN;
+        atomic_store_explicit(&shard->largest_gap, shard_size, memory_order_relaxed);
+        mgr->shards[u] = shard;
+        mgr->num_shards += 1;
+    }
+    _mem_maint_set(mgr, 1);
 
-    //   initialize top node of node heap
-    new_heap[0].allocated = 0;
-    new_heap[0].used = 1;
-    new_heap[0].alloc_record.mem = new_pool;
-    new_heap[0].prev = NULL;
-    new_heap[0].next = NULL;
-    new_heap[0].alloc_record.size = size;
-    //   initialize top node of gap index
-    new_ix[0].size = size;
-    new_ix[0].node = new_heap;
-    //   initialize pool mgr
-    mgr->gap_ix = new_ix;
-    mgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
-    mgr->node_heap = new_heap;
-    mgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
-    mgr->used_nodes = 1;
-    //   link pool mgr to pool store
-    pool_store[pool_store_size] = mgr;
-    pool_store_size += 1;
-    // return the address of the mgr, cast to (pool_pt)
-    return (pool_pt) mgr;
+    return pool;
+}
+
+pool_pt mem_pool_open_striped(size_t size, alloc_policy policy, unsigned num_stripes) {
+    // the stripes are shards, picked by their locks instead of by thread
+    pool_pt pool = mem_pool_open_sharded(size, policy, num_stripes);
+    if (pool != NULL) {
+        ((pool_mgr_pt) pool)->striped = 1;
+    }
+
+    return pool;
 }
 
 alloc_status mem_pool_close(pool_pt pool) {
@@ -211,210 +591,831 @@ alloc_status mem_pool_close(pool_pt pool) {
     // free mgr
 
     pool_mgr_pt del_pool = (pool_mgr_pt) pool;
-    if ((pool->mem != NULL) && (pool->num_gaps == 1) && (del_pool->used_nodes ==1)) {
-        free(pool->mem);
-        free(del_pool->node_heap);
-        free(del_pool->gap_ix);
-
-        for (int i = 0; i < pool_store_size; i++) {
-            if (del_pool == pool_store[i]) {
-                pool_store[i] = NULL;
-                break;
+    // the maintenance thread keeps out of the pool while it is being closed
+    _mem_maint_set(del_pool, 0);
+    // a sharded pool is closed once all of its shards are empty
+    if (del_pool->shards) {
+        for (unsigned u = 0; u < del_pool->num_shards; u++) {
+            pool_mgr_pt shard = del_pool->shards[u];
+            _mem_drain_remote(shard);
+            _mem_flush_pending(shard);
+            if ((shard->pool.num_gaps != 1) || (shard->used_nodes != 1)) {
+                _mem_maint_set(del_pool, 1);
+                return ALLOC_NOT_FREED;
             }
         }
-        free(del_pool);
+        for (unsigned u = 0; u < del_pool->num_shards; u++) {
+            _mem_close_mgr(del_pool->shards[u]);
+        }
+        _mem_unmap_region(pool->mem, pool->total_size, del_pool->backing);
+        _mem_close_mgr(del_pool);
+        return ALLOC_OK;
+    }
+    // deferred frees have to be coalesced before the pool can look empty
+    _mem_flush_pending(del_pool);
+#ifdef MEM_HAVE_MMAP
+    // a persistent pool keeps its allocations in the file
+    if (del_pool->backing == POOL_BACKING_FILE) {
+        alloc_status status = _mem_file_sync(del_pool);
+        _mem_unmap_region(pool->mem, pool->total_size, del_pool->backing);
+        close(del_pool->file_fd);
+        _mem_close_mgr(del_pool);
+        return status;
+    }
+    // a shared pool is only detached, the other processes may still use it
+    if (del_pool->backing == POOL_BACKING_SHARED) {
+        munmap(del_pool->shared, del_pool->shared->meta_size + pool->total_size);
+        close(del_pool->file_fd);
+        _mem_close_mgr(del_pool);
+        return ALLOC_OK;
+    }
+#endif
+    // added regions go first, if they are free
+    if (del_pool->num_regions > 1) {
+        mem_pool_shrink(pool);
+    }
+    if ((pool->mem != NULL) && (pool->num_gaps == 1) && (del_pool->used_nodes ==1)) {
+        _mem_unmap_region(pool->mem, pool->total_size, del_pool->backing);
+        _mem_close_mgr(del_pool);
         return ALLOC_OK;
     }
+    _mem_maint_set(del_pool, 1);
     return ALLOC_NOT_FREED;
 }
 
-alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
+alloc_status mem_pool_shrink(pool_pt pool) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
-    pool_mgr_pt mgr = (pool_mgr_pt)pool;
-    // check if any gaps, return null if none
-    if(pool->num_gaps == 0) {
-        return NULL;
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    // the shards of a sharded pool have fixed slices, but may have deferred frees
+    for (unsigned u = 0; u < mgr->num_shards; u++) {
+        mem_pool_shrink((pool_pt) mgr->shards[u]);
     }
-    // expand heap node, if necessary, quit on error
-    _mem_resize_node_heap(mgr);
-    // check used nodes fewer than total nodes, quit on error
-    assert(mgr->used_nodes < mgr->total_nodes);
-    // get a node for allocation:
-    node_pt suf_node = NULL;
-    // if FIRST_FIT, then find the first sufficient node in the node heap
-    if (pool->policy == FIRST_FIT) {
-        for (int i = 0; i < mgr->total_nodes; i++) {
-            if ((mgr->node_heap[i].allocated == 0) && (mgr->node_heap[i].alloc_record.size >= size)) {
-                suf_node = &mgr->node_heap[i];
+    _mem_lock(mgr);
+    // deferred frees are not gaps yet
+    _mem_flush_pending(mgr);
+    // give back every added region that is a single gap
+    // note: the first region is pool.mem itself, and stays
+    unsigned u = 1;
+    while (u < mgr->num_regions) {
+        region_pt region = &mgr->regions[u];
+        node_pt node = NULL;
+        for (unsigned i = 0; i < mgr->pool.num_gaps; i++) {
+            if ((mgr->gap_ix[i].node->alloc_record.mem == region->mem)
+                && (mgr->gap_ix[i].size == region->size)) {
+                node = mgr->gap_ix[i].node;
                 break;
             }
         }
-    }
-    // if BEST_FIT, then find the first sufficient node in the gap index
-    else if (pool->policy == BEST_FIT) {
-        for (int i = 0; i < mgr->pool.num_gaps; i++) {
-            if ((mgr->gap_ix[i].size >= size)) {
-                suf_node = mgr->gap_ix[i].node;
-                break;
-            }
+        if (node == NULL) {
+            u++;
+            continue;
+        }
+        //   remove the gap from the gap index and the list
+        alloc_status status = _mem_remove_from_gap_ix(mgr, node->alloc_record.size, node);
+        assert(status == ALLOC_OK);
+        node->prev->next = node->next;
+        if (node->next) {
+            node->next->prev = node->prev;
+        }
+        node->next = NULL;
+        node->prev = NULL;
+        node->used = 0;
+        mgr->used_nodes -= 1;
+        //   unmap the region and drop it from the table
+        mgr->pool.total_size -= region->size;
+        _mem_unmap_region(region->mem, region->size, region->backing);
+        mgr->num_regions -= 1;
+        for (unsigned v = u; v < mgr->num_regions; v++) {
+            mgr->regions[v] = mgr->regions[v + 1];
         }
     }
-    // check if node found
-    if (suf_node == NULL) {
+    _mem_unlock(mgr);
+
+    return ALLOC_OK;
+}
+
+pool_pt mem_pool_open_file(const char *path, size_t size, alloc_policy policy) {
+#ifdef MEM_HAVE_MMAP
+    // make sure there the pool store is allocated
+    assert(atomic_load(&pool_store[0]));
+    // open or create the file
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if ((fd >= 0) && (fstat(fd, &st) != 0)) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
         return NULL;
     }
-    // update metadata (num_allocs, alloc_size)
-    mgr->pool.num_allocs += 1;
-    mgr->pool.alloc_size += size;
-    // calculate the size of the remaining gap, if any
-    size_t suf_size;
-    suf_size = suf_node->alloc_record.size;
-    size_t r_size = suf_size  - size;
-    // remove node from gap index
-    _mem_remove_from_gap_ix(mgr, suf_node->alloc_record.size, suf_node);
-    // convert gap_node to an allocation node of given size
-    suf_node->allocated = 1;
-    suf_node->alloc_record.size = size;
-    // adjust node heap:
-    if (r_size > 0) {
-        //   if remaining gap, need a new node
-        node_pt unused_node;
-        //   find an unused one in the node heap
-        for (int i = 0; i < mgr->total_nodes; i++) {
-            if (mgr->node_heap[i].used == 0) {
-                unused_node = &mgr->node_heap[i];
-                break;
-            }
-        }
-        //   make sure one was found
-        assert(unused_node);
-        //   initialize it to a gap node
-        unused_node->used = 1;
-        unused_node->allocated = 0;
-        unused_node->alloc_record.size = r_size;
-        unused_node->alloc_record.mem = suf_node->alloc_record.mem + size*sizeof(char);
-        //   update metadata (used_nodes)
-        mgr->used_nodes += 1;
-        //   update linked list (new node right after the node for allocation)
-        unused_node->next = suf_node->next;
-        if (suf_node->next) {
-            suf_node->next->prev = unused_node;
+    // only an empty file is a new pool, whose pages are known to be zero
+    // note: an existing pool file brings its own size, and so does one that was never
+    //       synced, but its contents are unknown, and any other file is not touched
+    pool_file_header_t header;
+    int restore = 0;
+    int fresh = 0;
+    if (st.st_size == 0) {
+        if (ftruncate(fd, (off_t) (MEM_FILE_HEADER_SIZE + size)) != 0) {
+            close(fd);
+            return NULL;
         }
-        suf_node->next = unused_node;
-        unused_node->prev = suf_node;
-        //   add to gap index
-        assert(_mem_add_to_gap_ix(mgr, unused_node->alloc_record.size, unused_node) == ALLOC_OK);
-        //   check if successful
+        fresh = 1;
     }
-    // return allocation record by casting the node to (alloc_pt)
-    return (alloc_pt) suf_node;
+    else if ((pread(fd, &header, sizeof(header), 0) == sizeof(header))
+             && (memcmp(header.magic, MEM_FILE_MAGIC, sizeof(header.magic)) == 0)) {
+        size = (size_t) header.total_size;
+        policy = (alloc_policy) header.policy;
+        restore = 1;
+    }
+    else if (_mem_file_unsynced(fd, st.st_size)) {
+        size = (size_t) st.st_size - MEM_FILE_HEADER_SIZE;
+    }
+    else {
+        close(fd);
+        return NULL;
+    }
+    // map the header and the pool together
+    char *base = (char *) mmap(NULL, MEM_FILE_HEADER_SIZE + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    // set up the pool mgr over the pool part
+    pool_mgr_pt mgr = _mem_open_mgr(base + MEM_FILE_HEADER_SIZE, size, policy, POOL_BACKING_FILE);
+    if (mgr == NULL) {
+        munmap(base, MEM_FILE_HEADER_SIZE + size);
+        close(fd);
+        return NULL;
+    }
+    mgr->file_fd = fd;
+    // nothing is allocated yet, but only a new file is known to be zero
+    mgr->zero_top = (fresh) ? 0 : size;
+    // bring back the segments as of the last sync
+    if (restore && (_mem_file_restore(mgr, &header) != ALLOC_OK)) {
+        _mem_unmap_region(mgr->pool.mem, size, POOL_BACKING_FILE);
+        close(fd);
+        _mem_close_mgr(mgr);
+        return NULL;
+    }
+
+    return (pool_pt) mgr;
+#else
+    return NULL;
+#endif
 }
 
-alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
+alloc_status mem_pool_sync(pool_pt pool) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt mgr = (pool_mgr_pt) pool;
-    // get node from alloc by casting the pointer to (node_pt)
-    node_pt node = (node_pt) alloc;
-    // find the node in the node heap
-    node_pt del_node = NULL;
-    node_pt node_to_add = NULL;
+#ifdef MEM_HAVE_MMAP
+    // only persistent pools have anything to write
+    if (mgr->backing == POOL_BACKING_FILE) {
+        // deferred frees are not in the node list yet
+        _mem_flush_pending(mgr);
+        return _mem_file_sync(mgr);
+    }
+#endif
+    return ALLOC_FAIL;
+}
+
+size_t mem_alloc_offset(pool_pt pool, alloc_pt alloc) {
+    // offsets are from the start of the pool, so they survive remapping
+    return (size_t) (alloc->mem - pool->mem);
+}
 
-    for(int i = 0; i < mgr->total_nodes; i++) {
-        if (node == &mgr->node_heap[i]) {
-            del_node = &mgr->node_heap[i];
+alloc_pt mem_alloc_at(pool_pt pool, size_t offset) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    // the allocation is in the shard whose slice holds the offset
+    if (mgr->shards) {
+        if (offset >= pool->total_size) {
+            return NULL;
+        }
+        pool_mgr_pt shard = _mem_shard_for_mem(mgr, pool->mem + offset);
+        return mem_alloc_at((pool_pt) shard, (size_t) (pool->mem + offset - shard->pool.mem));
+    }
+    // walk the list to the allocation that starts at the offset
+    alloc_pt alloc = NULL;
+    _mem_lock(mgr);
+    for (node_pt node = mgr->node_heap; node; node = node->next) {
+        if (node->alloc_record.mem == pool->mem + offset) {
+            alloc = (node->allocated) ? (alloc_pt) node : NULL;
             break;
         }
     }
-    // this is node-to-delete
-    // make sure it's found
-    // convert to gap node
-    del_node->allocated = 0;
-    // update metadata (num_allocs, alloc_size)
-    mgr->pool.num_allocs -= 1;
-    mgr->pool.alloc_size -= del_node->alloc_record.size;
-    // if the next node in the list is also a gap, merge into node-to-delete
-    if ((del_node->next) && (del_node->next->allocated == 0)) {
-        //   remove the next node from gap index
-        node_pt next_node = del_node->next;
-        size_t next_node_size = next_node->alloc_record.size;
-        assert(_mem_remove_from_gap_ix(mgr, next_node_size, next_node) == ALLOC_OK);
-        //   check success
-        //   add the size to the node-to-delete
-        del_node->alloc_record.size += next_node_size;
-        //   update node as unused
-        next_node->used = 0;
-        //   update metadata (used nodes)
-        mgr->used_nodes -= 1;
-        //   update linked list:
-        if (next_node->next) {
-            next_node->next->prev = del_node;
-            del_node->next = next_node->next;
+    _mem_unlock(mgr);
+
+    return alloc;
+}
+
+pool_pt mem_pool_open_shared(const char *name, size_t size, alloc_policy policy) {
+#ifdef MEM_HAVE_MMAP
+    // make sure there the pool store is allocated
+    assert(atomic_load(&pool_store[0]));
+    // the header and the segment table take up whole pages in front of the pool
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t meta_size = sizeof(pool_shared_header_t) + MEM_SHARED_SEGMENTS * sizeof(pool_file_segment_t);
+    meta_size = ((meta_size + page_size - 1) / page_size) * page_size;
+    // create the shared memory object, or attach to the existing one
+    int create = 1;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ((fd < 0) && (errno == EEXIST)) {
+        create = 0;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+    pool_shared_header_pt header = NULL;
+    if (create) {
+        if ((size == 0) || (ftruncate(fd, (off_t) (meta_size + size)) != 0)) {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
         }
-        else {
-            del_node->next = NULL;
+        header = (pool_shared_header_pt) mmap(NULL, meta_size + size,
+                                              PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (header == MAP_FAILED) {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
         }
-        next_node->next = NULL;
-        next_node->prev = NULL;
-        /*
-                        if (next->next) {
-                            next->next->prev = node_to_del;
-                            node_to_del->next = next->next;
-                        } else {
-                            node_to_del->next = NULL;
-                        }
-                        next->next = NULL;
-                        next->prev = NULL;
-         */
-        node_to_add = del_node;
+        //   the lock has to work across processes, and survive a process dying with it
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef __linux__
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+        pthread_mutex_init(&header->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        //   the whole pool is one gap
+        pool_file_segment_pt table = (pool_file_segment_pt) (header + 1);
+        table[0].offset = 0;
+        table[0].size = size;
+        table[0].allocated = 0;
+        header->total_size = size;
+        header->policy = policy;
+        header->meta_size = meta_size;
+        header->capacity = MEM_SHARED_SEGMENTS;
+        header->num_segments = 1;
+        header->num_allocs = 0;
+        header->alloc_size = 0;
+        header->num_gaps = 1;
+        //   publish the header
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(header->magic, MEM_SHARED_MAGIC, sizeof(header->magic));
     }
-    // this merged node-to-delete might need to be added to the gap index
-    // but one more thing to check...
-    // if the previous node in the list is also a gap, merge into previous!
-    if ((del_node->prev) && (del_node->prev->allocated == 0)) {
-        //   remove the previous node from gap index
-        node_pt prev_node = del_node->prev;
-        size_t prev_node_size = prev_node->alloc_record.size;
-        assert(_mem_remove_from_gap_ix(mgr, prev_node_size, prev_node) == ALLOC_OK);
-        //   check success
-        //   add the size of node-to-delete to the previous
-        prev_node->alloc_record.size += del_node->alloc_record.size;
-        //   update node-to-delete as unused
-        del_node->used = 0;
-        //   update metadata (used_nodes)
-        mgr->used_nodes -= 1;
-        //   update linked list
-        if (del_node->next) {
-            prev_node->next = del_node->next;
-            del_node->next->prev = prev_node;
+    else {
+        //   wait for the creating process to size the object and publish the header
+        struct stat st;
+        unsigned spins = 0;
+        while (((fstat(fd, &st) != 0) || ((size_t) st.st_size < meta_size)) && (spins++ < MEM_SHARED_ATTACH_SPINS)) {
+            sched_yield();
         }
-        else {
-            prev_node->next = NULL;
+        if ((size_t) st.st_size < meta_size) {
+            close(fd);
+            return NULL;
         }
-        del_node->next = NULL;
-        del_node->prev = NULL;
-        /*
-                        if (node_to_del->next) {
-                            prev->next = node_to_del->next;
-                            node_to_del->next->prev = prev;
-                        } else {
-                            prev->next = NULL;
-                        }
-                        node_to_del->next = NULL;
-                        node_to_del->prev = NULL;
-         */
-        //prev_node->next->alloc_record.mem = prev_node->alloc_record.mem + prev_node->alloc_record.size*sizeof(char);
-        node_to_add = prev_node;
-    }
-    //   change the node to add to the previous node!
-
-    // add the resulting node to the gap index
-    if (node_to_add) {
-        assert(_mem_add_to_gap_ix(mgr, node_to_add->alloc_record.size, node_to_add) == ALLOC_OK);
+        header = (pool_shared_header_pt) mmap(NULL, (size_t) st.st_size,
+                                              PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (header == MAP_FAILED) {
+            close(fd);
+            return NULL;
+        }
+        while ((memcmp(header->magic, MEM_SHARED_MAGIC, sizeof(header->magic)) != 0)
+               && (spins++ < MEM_SHARED_ATTACH_SPINS)) {
+            sched_yield();
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((memcmp(header->magic, MEM_SHARED_MAGIC, sizeof(header->magic)) != 0)
+            || (header->meta_size != meta_size)
+            || (header->meta_size + header->total_size != (uint64_t) st.st_size)) {
+            munmap(header, (size_t) st.st_size);
+            close(fd);
+            return NULL;
+        }
+        size = (size_t) header->total_size;
+        policy = (alloc_policy) header->policy;
+    }
+    // set up a local pool mgr, the shared header is the real metadata
+    pool_mgr_pt mgr = _mem_open_mgr((char *) header + meta_size, size, policy, POOL_BACKING_SHARED);
+    if (mgr == NULL) {
+        munmap(header, meta_size + size);
+        close(fd);
+        return NULL;
+    }
+    mgr->file_fd = fd;
+    mgr->shared = header;
+    mgr->zero_top = size;
+    //   take over the current metadata, which unlocking copies
+    if (_mem_shared_lock(mgr) != ALLOC_OK) {
+        munmap(header, meta_size + size);
+        close(fd);
+        _mem_close_mgr(mgr);
+        return NULL;
+    }
+    _mem_shared_unlock(mgr);
+
+    return (pool_pt) mgr;
+#else
+    return NULL;
+#endif
+}
+
+alloc_status mem_pool_unlink_shared(const char *name) {
+#ifdef MEM_HAVE_MMAP
+    // attached processes keep their mappings, the name is gone
+    return (shm_unlink(name) == 0) ? ALLOC_OK : ALLOC_FAIL;
+#else
+    return ALLOC_FAIL;
+#endif
+}
+
+uint64_t mem_shared_alloc(pool_pt pool, size_t size) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+#ifdef MEM_HAVE_MMAP
+    if ((mgr->backing != POOL_BACKING_SHARED) || (size == 0) || (_mem_shared_lock(mgr) != ALLOC_OK)) {
+        return MEM_SHARED_NULL;
+    }
+    pool_shared_header_pt header = mgr->shared;
+    pool_file_segment_pt table = (pool_file_segment_pt) (header + 1);
+    // find a sufficient gap, per the pool's policy
+    uint64_t found = header->num_segments;
+    for (uint64_t i = 0; i < header->num_segments; i++) {
+        if ((table[i].allocated == 0) && (table[i].size >= size)) {
+            if ((found == header->num_segments) || (table[i].size < table[found].size)) {
+                found = i;
+            }
+            if (header->policy == FIRST_FIT) {
+                break;
+            }
+        }
+    }
+    // a remainder needs a new entry in the table, which cannot grow
+    if ((found == header->num_segments)
+        || ((table[found].size > size) && (header->num_segments == header->capacity))) {
+        _mem_shared_unlock(mgr);
+        return MEM_SHARED_NULL;
+    }
+    // carve the allocation out of the front of the gap
+    if (table[found].size > size) {
+        memmove(&table[found + 2], &table[found + 1],
+                (header->num_segments - found - 1) * sizeof(pool_file_segment_t));
+        table[found + 1].offset = table[found].offset + size;
+        table[found + 1].size = table[found].size - size;
+        table[found + 1].allocated = 0;
+        table[found].size = size;
+        header->num_segments += 1;
     }
     else {
-        assert(_mem_add_to_gap_ix(mgr, del_node->alloc_record.size, del_node) == ALLOC_OK);
+        header->num_gaps -= 1;
     }
-    // check success
+    table[found].allocated = 1;
+    header->num_allocs += 1;
+    header->alloc_size += size;
+    uint64_t offset = table[found].offset;
+    _mem_shared_unlock(mgr);
+
+    return offset;
+#else
+    return MEM_SHARED_NULL;
+#endif
+}
+
+alloc_status mem_shared_free(pool_pt pool, uint64_t offset) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+#ifdef MEM_HAVE_MMAP
+    if ((mgr->backing != POOL_BACKING_SHARED) || (_mem_shared_lock(mgr) != ALLOC_OK)) {
+        return ALLOC_FAIL;
+    }
+    pool_shared_header_pt header = mgr->shared;
+    pool_file_segment_pt table = (pool_file_segment_pt) (header + 1);
+    // the table is sorted by offset, so search it in halves
+    uint64_t lo = 0;
+    uint64_t hi = header->num_segments;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (table[mid].offset < offset) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if ((lo == header->num_segments) || (table[lo].offset != offset) || (table[lo].allocated == 0)) {
+        _mem_shared_unlock(mgr);
+        return ALLOC_FAIL;
+    }
+    // turn the allocation into a gap
+    table[lo].allocated = 0;
+    header->num_allocs -= 1;
+    header->alloc_size -= table[lo].size;
+    header->num_gaps += 1;
+    // merge with the next and the previous gap
+    if ((lo + 1 < header->num_segments) && (table[lo + 1].allocated == 0)) {
+        table[lo].size += table[lo + 1].size;
+        memmove(&table[lo + 1], &table[lo + 2],
+                (header->num_segments - lo - 2) * sizeof(pool_file_segment_t));
+        header->num_segments -= 1;
+        header->num_gaps -= 1;
+    }
+    if ((lo > 0) && (table[lo - 1].allocated == 0)) {
+        table[lo - 1].size += table[lo].size;
+        memmove(&table[lo], &table[lo + 1],
+                (header->num_segments - lo - 1) * sizeof(pool_file_segment_t));
+        header->num_segments -= 1;
+        header->num_gaps -= 1;
+    }
+    _mem_shared_unlock(mgr);
+
+    return ALLOC_OK;
+#else
+    return ALLOC_FAIL;
+#endif
+}
+
+pool_backing mem_pool_backing(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+
+    return mgr->backing;
+}
+
+alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    // a sharded pool allocates from the calling thread's shard,
+    // and a full shard borrows from the sibling with the most room
+    if (mgr->shards) {
+        pool_mgr_pt home = _mem_shard_for_thread(mgr);
+        alloc_pt alloc = mem_new_alloc((pool_pt) home, size);
+        pool_mgr_pt victim = (alloc) ? NULL : _mem_shard_victim(mgr, home, size);
+        return (victim) ? mem_new_alloc((pool_pt) victim, size) : alloc;
+    }
+    // no alignment constraint beyond the byte
+    if (!(mgr->flags & POOL_THREAD_CACHE)) {
+        return mem_new_alloc_aligned(pool, size, 1);
+    }
+    // look in this thread's cache first, the lock is not needed for it
+    size = _mem_round_size(mgr, size);
+    thread_cache_pt cache = _mem_thread_cache(mgr, 1);
+    int bin = (cache) ? _mem_thread_cache_bin(cache, size, 1) : -1;
+    if (bin < 0) {
+        return mem_new_alloc_aligned(pool, size, 1);
+    }
+    if (cache->counts[bin] > 0) {
+        cache->counts[bin] -= 1;
+        cache->blocks[bin][cache->counts[bin]]->cached = 0;
+        return (alloc_pt) cache->blocks[bin][cache->counts[bin]];
+    }
+    // refill the bin in a batch, under one lock
+    _mem_lock(mgr);
+    alloc_pt alloc = _mem_new_alloc(mgr, size, 1);
+    for (unsigned u = 1; (alloc != NULL) && (u < MEM_THREAD_CACHE_BATCH); u++) {
+        alloc_pt extra = _mem_new_alloc(mgr, size, 1);
+        if (extra == NULL) {
+            break;
+        }
+        ((node_pt) extra)->cached = 1;
+        cache->blocks[bin][cache->counts[bin]] = (node_pt) extra;
+        cache->counts[bin] += 1;
+    }
+    _mem_unlock(mgr);
+    // the bin holds on to its size only while it has blocks
+    if (cache->counts[bin] == 0) {
+        cache->sizes[bin] = 0;
+    }
+
+    return alloc;
+}
+
+alloc_pt mem_new_alloc_aligned(pool_pt pool, size_t size, size_t alignment) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    if (mgr->shards) {
+        pool_mgr_pt home = _mem_shard_for_thread(mgr);
+        alloc_pt alloc = mem_new_alloc_aligned((pool_pt) home, size, alignment);
+        pool_mgr_pt victim = (alloc) ? NULL : _mem_shard_victim(mgr, home, size);
+        return (victim) ? mem_new_alloc_aligned((pool_pt) victim, size, alignment) : alloc;
+    }
+    // only a pool opened with a lock takes it
+    _mem_lock(mgr);
+    alloc_pt alloc = _mem_new_alloc(mgr, size, alignment);
+    _mem_unlock(mgr);
+
+    return alloc;
+}
+
+alloc_pt mem_new_alloc_near(pool_pt pool, size_t size, alloc_pt hint_alloc) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    // get node from hint by casting the pointer to (node_pt)
+    node_pt hint_node = (node_pt) hint_alloc;
+    // near the hint means in the hint's shard, or anywhere if that one is full
+    // note: the hint is not passed on to a sibling, whose node heap it is not in,
+    //       and the shard is found by the hint's node, which is safe to check unlocked
+    if (mgr->shards) {
+        pool_mgr_pt home = NULL;
+        for (unsigned u = 0; (u < mgr->num_shards) && hint_node; u++) {
+            if (_mem_owns_node(mgr->shards[u], hint_node)) {
+                home = mgr->shards[u];
+            }
+        }
+        if (home == NULL) {
+            home = _mem_shard_for_thread(mgr);
+            hint_alloc = NULL;
+        }
+        alloc_pt alloc = mem_new_alloc_near((pool_pt) home, size, hint_alloc);
+        pool_mgr_pt victim = (alloc) ? NULL : _mem_shard_victim(mgr, home, size);
+        return (victim) ? mem_new_alloc_near((pool_pt) victim, size, NULL) : alloc;
+    }
+    _mem_lock(mgr);
+    alloc_pt alloc = _mem_new_alloc_near(mgr, size, hint_node);
+    _mem_unlock(mgr);
+
+    return alloc;
+}
+
+alloc_pt mem_new_alloc_zeroed(pool_pt pool, size_t size) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    if (mgr->shards) {
+        pool_mgr_pt home = _mem_shard_for_thread(mgr);
+        alloc_pt alloc = mem_new_alloc_zeroed((pool_pt) home, size);
+        pool_mgr_pt victim = (alloc) ? NULL : _mem_shard_victim(mgr, home, size);
+        return (victim) ? mem_new_alloc_zeroed((pool_pt) victim, size) : alloc;
+    }
+    // allocate as usual
+    _mem_lock(mgr);
+    alloc_pt alloc = _mem_new_alloc(mgr, size, 1);
+    size_t dirty = mgr->last_dirty;
+    _mem_unlock(mgr);
+    if (alloc == NULL) {
+        return NULL;
+    }
+    // only the bytes that were handed out before can be dirty, clear just those
+    // note: the allocation is the caller's now, so this is done outside the lock
+    memset(alloc->mem, 0, dirty);
+
+    return alloc;
+}
+
+alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    // get node from alloc by casting the pointer to (node_pt)
+    node_pt node = (node_pt) alloc;
+    // the block goes back to the shard it came from, whichever thread frees it
+    // note: a thread that does not allocate from that shard queues the block
+    //       for the shard's own threads, instead of taking the shard's lock,
+    //       but a striped pool has no own threads, so the stripe is locked
+    if (mgr->shards) {
+        pool_mgr_pt shard = _mem_shard_for_mem(mgr, alloc->mem);
+        if (!mgr->striped && ((thread_shard == 0) || (_mem_shard_for_thread(mgr) != shard))) {
+            if (!_mem_owns_node(shard, node) || (node->allocated == 0) || atomic_exchange(&node->remote, 1)) {
+                return ALLOC_FAIL;
+            }
+            node_pt head = atomic_load_explicit(&shard->remote_q, memory_order_relaxed);
+            do {
+                atomic_store_explicit(&node->remote_next, head, memory_order_relaxed);
+            } while (!atomic_compare_exchange_weak_explicit(&shard->remote_q, &head, node,
+                                                            memory_order_release,
+                                                            memory_order_relaxed));
+            return ALLOC_OK;
+        }
+        mgr = shard;
+    }
+    // keep the block in this thread's cache, if it has room for its size
+    // note: the pool's lock is not taken, so the block is checked here,
+    //       and a block already in a cache is not freed again
+    if (mgr->flags & POOL_THREAD_CACHE) {
+        if (!_mem_owns_node(mgr, node) || (node->allocated == 0) || node->cached) {
+            return ALLOC_FAIL;
+        }
+        thread_cache_pt cache = _mem_thread_cache(mgr, 1);
+        int bin = (cache) ? _mem_thread_cache_bin(cache, node->alloc_record.size, 1) : -1;
+        if (bin >= 0) {
+            //   a full bin gives its older half back to the pool, under one lock
+            if (cache->counts[bin] == MEM_THREAD_CACHE_DEPTH) {
+                _mem_thread_cache_drain(cache, bin, MEM_THREAD_CACHE_BATCH);
+            }
+            node->cached = 1;
+            cache->blocks[bin][cache->counts[bin]] = node;
+            cache->counts[bin] += 1;
+            return ALLOC_OK;
+        }
+    }
+    _mem_lock(mgr);
+    alloc_status status = _mem_del_alloc(mgr, node);
+    _mem_unlock(mgr);
+
+    return status;
+}
+
+alloc_status mem_thread_cache_flush(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    // give all of this thread's blocks back to the pool, and free the entry
+    thread_cache_pt cache = _mem_thread_cache(mgr, 0);
+    if (cache == NULL) {
+        return ALLOC_OK;
+    }
+    for (int bin = 0; bin < MEM_THREAD_CACHE_BINS; bin++) {
+        _mem_thread_cache_drain(cache, bin, cache->counts[bin]);
+    }
+    cache->pool_mgr = NULL;
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_set_deferred_free(pool_pt pool, unsigned threshold) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    // a sharded pool passes its settings on to the shards
+    for (unsigned u = 0; u < mgr->num_shards; u++) {
+        if (mem_pool_set_deferred_free((pool_pt) mgr->shards[u], threshold) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+    }
+    // allocate the queue, outside of the lock
+    // note: zero threshold turns deferring off
+    node_pt *queue = NULL;
+    if (threshold > 0) {
+        queue = (node_pt *) calloc(threshold, sizeof(node_pt));
+        if (queue == NULL) {
+            return ALLOC_FAIL;
+        }
+    }
+    // coalesce whatever is queued under the old setting, and swap the queues
+    // note: the maintenance thread may be flushing the pool at the same time
+    _mem_lock(mgr);
+    _mem_flush_pending(mgr);
+    node_pt *old_queue = mgr->pending_q;
+    mgr->pending_q = queue;
+    mgr->pending_threshold = threshold;
+    _mem_unlock(mgr);
+    free(old_queue);
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_set_size_classes(pool_pt pool,
+                                       size_t quantum,
+                                       size_t small_max,
+                                       unsigned steps_per_doubling) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    // geometric steps are needed above the small sizes
+    if ((quantum > 0) && (steps_per_doubling == 0)) {
+        return ALLOC_FAIL;
+    }
+    for (unsigned u = 0; u < mgr->num_shards; u++) {
+        mem_pool_set_size_classes((pool_pt) mgr->shards[u], quantum, small_max, steps_per_doubling);
+    }
+    // zero quantum turns rounding off
+    _mem_lock(mgr);
+    mgr->class_quantum = quantum;
+    mgr->class_small_max = small_max;
+    mgr->class_steps = steps_per_doubling;
+    _mem_unlock(mgr);
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_reserve(pool_pt pool, unsigned max_segments) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    // a shared pool has a fixed table instead
+    if (mgr->backing == POOL_BACKING_SHARED) {
+        return ALLOC_FAIL;
+    }
+    for (unsigned u = 0; u < mgr->num_shards; u++) {
+        if (mem_pool_reserve((pool_pt) mgr->shards[u], max_segments) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+    }
+    // size the node heap and the gap index so that they never pass their fill factor
+    // note: an allocation takes up to two more nodes after the fill check
+    unsigned nodes = (unsigned) (max_segments / MEM_NODE_HEAP_FILL_FACTOR) + 3;
+    unsigned gaps = (unsigned) (max_segments / MEM_GAP_IX_FILL_FACTOR) + 2;
+    _mem_lock(mgr);
+    alloc_status status = _mem_expand_node_heap(mgr, nodes);
+    if (status == ALLOC_OK) {
+        status = _mem_expand_gap_ix(mgr, gaps);
+    }
+    _mem_unlock(mgr);
+
+    return status;
+}
+
+alloc_status mem_pool_set_trim_threshold(pool_pt pool, size_t threshold) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    // only mapped pages can be given back
+    // note: an external buffer is not the pool's to give back
+    if ((threshold > 0)
+        && ((mgr->backing == POOL_BACKING_HEAP) || (mgr->backing == POOL_BACKING_EXTERNAL))) {
+        return ALLOC_FAIL;
+    }
+    for (unsigned u = 0; u < mgr->num_shards; u++) {
+        mem_pool_set_trim_threshold((pool_pt) mgr->shards[u], threshold);
+    }
+    // zero threshold turns trimming off
+    _mem_lock(mgr);
+    mgr->trim_threshold = threshold;
+    _mem_unlock(mgr);
+
+    return ALLOC_OK;
+}
+
+slab_pt mem_slab_open(pool_pt pool, size_t object_size, unsigned num_objects) {
+    // object indices have to fit in the free list head, next to the tag
+    if ((object_size == 0) || (num_objects == 0) || (num_objects >= MEM_SLAB_NIL)) {
+        return NULL;
+    }
+    object_size = (object_size + MEM_SLAB_ALIGNMENT - 1) & ~(MEM_SLAB_ALIGNMENT - 1);
+    if (object_size > SIZE_MAX / num_objects) {
+        return NULL;
+    }
+    // the objects are handed out by address, so the region must never move
+    if (((pool_mgr_pt) pool)->flags & POOL_REMAP) {
+        return NULL;
+    }
+    // allocate the slab and its free list links
+    slab_pt slab = (slab_pt) calloc(1, sizeof(slab_t));
+    if (slab == NULL) {
+        return NULL;
+    }
+    slab->next = (_Atomic uint32_t *) calloc(num_objects, sizeof(_Atomic uint32_t));
+    if (slab->next == NULL) {
+        free(slab);
+        return NULL;
+    }
+    // carve the objects out of the pool in one piece
+    alloc_pt alloc = mem_new_alloc_aligned(pool, object_size * num_objects, MEM_SLAB_REGION_ALIGNMENT);
+    if (alloc == NULL) {
+        free(slab->next);
+        free(slab);
+        return NULL;
+    }
+    slab->mem = alloc->mem;
+    slab->alloc = alloc;
+    slab->pool = pool;
+    slab->object_size = object_size;
+    slab->num_objects = num_objects;
+    // chain all the objects in order
+    for (unsigned u = 0; u < num_objects; u++) {
+        atomic_init(&slab->next[u], (u + 1 < num_objects) ? u + 1 : MEM_SLAB_NIL);
+    }
+    atomic_init(&slab->head, 0);
+
+    return slab;
+}
+
+alloc_status mem_slab_close(slab_pt slab) {
+    // give the region back to the pool
+    alloc_status status = mem_del_alloc(slab->pool, slab->alloc);
+    free(slab->next);
+    free(slab);
+
+    return status;
+}
+
+void *mem_slab_alloc(slab_pt slab) {
+    // pop the first free object
+    uint64_t head = atomic_load_explicit(&slab->head, memory_order_acquire);
+    uint64_t new_head;
+    do {
+        uint32_t index = (uint32_t) head;
+        if (index == MEM_SLAB_NIL) {
+            return NULL;
+        }
+        uint32_t next = atomic_load_explicit(&slab->next[index], memory_order_relaxed);
+        new_head = (((head >> 32) + 1) << 32) | next;
+    } while (!atomic_compare_exchange_weak_explicit(&slab->head, &head, new_head,
+                                                    memory_order_acquire, memory_order_acquire));
+
+    return slab->mem + (size_t) (uint32_t) head * slab->object_size;
+}
+
+alloc_status mem_slab_free(slab_pt slab, void *object) {
+    // make sure the object is one of the slab's
+    uintptr_t offset = (uintptr_t) object - (uintptr_t) slab->mem;
+    if ((offset >= slab->object_size * slab->num_objects) || (offset % slab->object_size != 0)) {
+        return ALLOC_FAIL;
+    }
+    uint32_t index = (uint32_t) (offset / slab->object_size);
+    // push it as the first free object
+    uint64_t head = atomic_load_explicit(&slab->head, memory_order_relaxed);
+    uint64_t new_head;
+    do {
+        atomic_store_explicit(&slab->next[index], (uint32_t) head, memory_order_relaxed);
+        new_head = (((head >> 32) + 1) << 32) | index;
+    } while (!atomic_compare_exchange_weak_explicit(&slab->head, &head, new_head,
+                                                    memory_order_release, memory_order_relaxed));
 
     return ALLOC_OK;
 }
@@ -424,6 +1425,56 @@ void mem_inspect_pool(pool_pt pool,
                       unsigned *num_segments) {
     // get the mgr from the pool
     pool_mgr_pt mgr = (pool_mgr_pt) pool;
+#ifdef MEM_HAVE_MMAP
+    // a shared pool has its segments in the shared table
+    if (mgr->backing == POOL_BACKING_SHARED) {
+        if (_mem_shared_lock(mgr) != ALLOC_OK) {
+            *segments = NULL;
+            *num_segments = 0;
+            return;
+        }
+        unsigned count = (unsigned) mgr->shared->num_segments;
+        pool_segment_pt shared_segs = (pool_segment_pt) calloc(count, sizeof(pool_segment_t));
+        assert(shared_segs);
+        pool_file_segment_pt table = (pool_file_segment_pt) (mgr->shared + 1);
+        for (unsigned u = 0; u < count; u++) {
+            shared_segs[u].size = (size_t) table[u].size;
+            shared_segs[u].allocated = (unsigned long) table[u].allocated;
+        }
+        _mem_shared_unlock(mgr);
+        *segments = shared_segs;
+        *num_segments = count;
+        return;
+    }
+#endif
+    // a sharded pool lists the segments of its shards in address order
+    // note: the pool's own counters are left alone, as other threads may be reading them,
+    //       and the shards' counters are only added up into a snapshot
+    if (mgr->shards) {
+        pool_segment_pt *shard_segs = (pool_segment_pt *) calloc(mgr->num_shards, sizeof(pool_segment_pt));
+        unsigned *shard_counts = (unsigned *) calloc(mgr->num_shards, sizeof(unsigned));
+        assert(shard_segs && shard_counts);
+        unsigned count = 0;
+        for (unsigned u = 0; u < mgr->num_shards; u++) {
+            mem_inspect_pool((pool_pt) mgr->shards[u], &shard_segs[u], &shard_counts[u]);
+            count += shard_counts[u];
+        }
+        pool_segment_pt segs = (pool_segment_pt) calloc(count, sizeof(pool_segment_t));
+        assert(segs);
+        unsigned i = 0;
+        for (unsigned u = 0; u < mgr->num_shards; u++) {
+            memcpy(&segs[i], shard_segs[u], shard_counts[u] * sizeof(pool_segment_t));
+            i += shard_counts[u];
+            free(shard_segs[u]);
+        }
+        free(shard_segs);
+        free(shard_counts);
+        *segments = segs;
+        *num_segments = count;
+        return;
+    }
+    _mem_lock(mgr);
+    _mem_drain_remote(mgr);
     // allocate the segments array with size == used_nodes
     pool_segment_pt segs = (pool_segment_pt) calloc(mgr->used_nodes, sizeof(pool_segment_t));
     // check successful
@@ -438,9 +1489,11 @@ void mem_inspect_pool(pool_pt pool,
         first_node = first_node->next;
         i++;
     }
+    unsigned count = mgr->used_nodes;
+    _mem_unlock(mgr);
 
     *segments = segs;
-    *num_segments = mgr->used_nodes;
+    *num_segments = count;
     // "return" the values:
     /*
                     *segments = segs;
@@ -448,6 +1501,57 @@ void mem_inspect_pool(pool_pt pool,
      */
 }
 
+alloc_status mem_inspect_pool_snapshot(pool_pt pool,
+                                       pool_t *stats,
+                                       pool_segment_pt *segments,
+                                       unsigned *num_segments) {
+    // get the mgr from the pool
+    pool_mgr_pt mgr = (pool_mgr_pt) pool;
+    // a sharded pool is a snapshot of each shard in turn, in address order
+    if (mgr->shards) {
+        pool_segment_pt segs = NULL;
+        unsigned count = 0;
+        *stats = *pool;
+        stats->num_allocs = 0;
+        stats->alloc_size = 0;
+        stats->num_gaps = 0;
+        for (unsigned u = 0; u < mgr->num_shards; u++) {
+            pool_t shard_stats;
+            pool_segment_pt shard_segs = NULL;
+            unsigned shard_count = 0;
+            if (_mem_snapshot_mgr(mgr->shards[u], &shard_stats, &shard_segs, &shard_count) != ALLOC_OK) {
+                free(segs);
+                return ALLOC_FAIL;
+            }
+            pool_segment_pt more = (pool_segment_pt) realloc(segs, (count + shard_count) * sizeof(pool_segment_t));
+            if (more == NULL) {
+                free(shard_segs);
+                free(segs);
+                return ALLOC_FAIL;
+            }
+            segs = more;
+            memcpy(&segs[count], shard_segs, shard_count * sizeof(pool_segment_t));
+            count += shard_count;
+            free(shard_segs);
+            stats->num_allocs += shard_stats.num_allocs;
+            stats->alloc_size += shard_stats.alloc_size;
+            stats->num_gaps += shard_stats.num_gaps;
+        }
+        *segments = segs;
+        *num_segments = count;
+        return ALLOC_OK;
+    }
+    // a pool without a lock has no concurrent writers to wait out,
+    // and a shared pool has its own process-shared lock
+    if (!(mgr->flags & (POOL_LOCK_SPIN | POOL_LOCK_MUTEX)) || (mgr->backing == POOL_BACKING_SHARED)) {
+        mem_inspect_pool(pool, segments, num_segments);
+        *stats = *pool;
+        return ALLOC_OK;
+    }
+
+    return _mem_snapshot_mgr(mgr, stats, segments, num_segments);
+}
+
 
 
 /***********************************/
@@ -455,31 +1559,244 @@ void mem_inspect_pool(pool_pt pool,
 /* Definitions of static functions */
 /*                                 */
 /***********************************/
-static alloc_status _mem_resize_pool_store() {
-    // check if necessary
-    /*
-                if (((float) pool_store_size / pool_store_capacity)
-                    > MEM_POOL_STORE_FILL_FACTOR) {...}
-     */
-    // don't forget to update capacity variables
-    if (((float) pool_store_size / pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR) {
-        pool_mgr_pt* resize = (pool_mgr_pt*) realloc(pool_store, pool_store_capacity*MEM_POOL_STORE_EXPAND_FACTOR );
-        assert(resize);
-        pool_store = resize;
-        pool_store_capacity = pool_store_capacity*MEM_POOL_STORE_EXPAND_FACTOR;
-        return ALLOC_OK;
+static pool_slot_pt _mem_pool_store_slot(unsigned ix, int create) {
+    // find the chunk the slot is in
+    unsigned chunk = 0;
+    unsigned chunk_capacity = MEM_POOL_STORE_INIT_CAPACITY;
+    while (ix >= chunk_capacity) {
+        ix -= chunk_capacity;
+        chunk_capacity *= MEM_POOL_STORE_EXPAND_FACTOR;
+        if (++chunk == MEM_POOL_STORE_CHUNKS) {
+            return NULL;
+        }
+    }
+    // allocate the chunk, if necessary
+    // note: racing threads may both allocate it, the one that loses frees its own
+    pool_slot_pt slots = atomic_load_explicit(&pool_store[chunk], memory_order_acquire);
+    if ((slots == NULL) && create) {
+        pool_slot_pt new_slots = (pool_slot_pt) calloc(chunk_capacity, sizeof(pool_slot_t));
+        if (new_slots == NULL) {
+            return NULL;
+        }
+        if (atomic_compare_exchange_strong_explicit(&pool_store[chunk], &slots, new_slots,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            slots = new_slots;
+        }
+        else {
+            free(new_slots);
+        }
     }
 
-    return ALLOC_FAIL;
+    return (slots) ? &slots[ix] : NULL;
+}
+
+static pool_pt _mem_open_pool(size_t size, alloc_policy policy, unsigned flags, int node) {
+    // make sure there the pool store is allocated
+    assert(atomic_load(&pool_store[0]));
+    // huge pages come in whole pages only
+    if (flags & POOL_HUGE_PAGES) {
+        size = ((size + MEM_HUGE_PAGE_SIZE - 1) / MEM_HUGE_PAGE_SIZE) * MEM_HUGE_PAGE_SIZE;
+    }
+    // only mapped pages can be unlocked on close, heap pages may be shared with other data,
+    // and only mapped pages can be remapped
+    if (flags & (POOL_MLOCK | POOL_REMAP)) {
+        flags |= POOL_MMAP;
+    }
+    // the threads' caches fill and drain the one pool, so it has to be locked
+    if ((flags & POOL_THREAD_CACHE) && !(flags & (POOL_LOCK_SPIN | POOL_LOCK_MUTEX))) {
+        return NULL;
+    }
+    // a remap can move the pool under other threads, so it is for one thread only
+    // note: e.g. a zeroed allocation is cleared outside the lock, where the pool may move
+    if ((flags & POOL_REMAP) && (flags & (POOL_LOCK_SPIN | POOL_LOCK_MUTEX | POOL_THREAD_CACHE))) {
+        return NULL;
+    }
+    // allocate a new memory pool
+    // note: the region starts out zero-filled whatever the backing,
+    //       and zero_top tracks how much of the pool is still known to be zero
+    // note: pages populated by mmap() would land before they are bound, so a bound pool
+    //       is mapped untouched, and faulted in after
+    pool_backing backing;
+    unsigned map_flags = (node != MEM_NUMA_NONE) ? (flags & ~POOL_PREFAULT) : flags;
+    char* new_pool = _mem_map_region(size, map_flags, &backing);
+    // check success, on error return null
+    if (new_pool == NULL) {
+        return NULL;
+    }
+    // place the pages on the node, before they are first touched
+    if ((node != MEM_NUMA_NONE) && (backing != POOL_BACKING_HEAP)) {
+        _mem_numa_bind(new_pool, size, node);
+    }
+    else {
+        node = MEM_NUMA_NONE;
+    }
+    // fault in, and lock, the pages up front, if asked to
+    if (_mem_warm_region(new_pool, size, flags) != ALLOC_OK) {
+        _mem_unmap_region(new_pool, size, backing);
+        return NULL;
+    }
+    // set up the pool mgr over it
+    pool_mgr_pt mgr = _mem_open_mgr(new_pool, size, policy, backing);
+    // check success, on error deallocate pool and return null
+    if (mgr == NULL) {
+        _mem_unmap_region(new_pool, size, backing);
+        return NULL;
+    }
+    mgr->flags = flags;
+    mgr->numa_node = node;
+    // set up the lock, if any
+#ifdef MEM_HAVE_PTHREADS
+    if (flags & POOL_LOCK_MUTEX) {
+        pthread_mutex_init(&mgr->mutex, NULL);
+    }
+#else
+    // note: without pthreads, the spinlock stands in for the mutex
+    if (flags & POOL_LOCK_MUTEX) {
+        mgr->flags = (flags & ~POOL_LOCK_MUTEX) | POOL_LOCK_SPIN;
+    }
+#endif
+    // a growable pool keeps track of its regions, starting with this one
+    if (flags & POOL_GROWABLE) {
+        mgr->regions = (region_pt) calloc(MEM_REGIONS_INIT_CAPACITY, sizeof(region_t));
+        if (mgr->regions == NULL) {
+            _mem_unmap_region(new_pool, size, backing);
+            _mem_close_mgr(mgr);
+            return NULL;
+        }
+        mgr->regions[0].mem = new_pool;
+        mgr->regions[0].size = size;
+        mgr->regions[0].backing = backing;
+        mgr->regions_capacity = MEM_REGIONS_INIT_CAPACITY;
+        mgr->num_regions = 1;
+    }
+    // a locked pool is set up, so the maintenance thread may visit it now
+    _mem_maint_set(mgr, 1);
+    // return the address of the mgr, cast to (pool_pt)
+    return (pool_pt) mgr;
+}
+
+
+static char *_mem_map_region(size_t size, unsigned flags, pool_backing *backing) {
+#ifdef MEM_HAVE_MMAP
+    char *mem;
+    int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    map_flags |= MAP_NORESERVE;
+#endif
+    if (flags & POOL_HUGE_PAGES) {
+#ifdef MAP_HUGETLB
+        // try reserved huge pages first
+        mem = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            *backing = POOL_BACKING_HUGETLB;
+            return mem;
+        }
+#endif
+        // otherwise map extra, so the region can start on a huge page boundary
+        char *raw = (char *) mmap(NULL, size + MEM_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, map_flags, -1, 0);
+        if (raw == MAP_FAILED) {
+            return NULL;
+        }
+        mem = (char *) (((uintptr_t) raw + MEM_HUGE_PAGE_SIZE - 1) & ~((uintptr_t) MEM_HUGE_PAGE_SIZE - 1));
+        //   trim the unaligned head and tail
+        if (mem > raw) {
+            munmap(raw, mem - raw);
+        }
+        munmap(mem + size, (raw + MEM_HUGE_PAGE_SIZE) - mem);
+        //   ask for transparent huge pages
+        *backing = POOL_BACKING_MMAP;
+#ifdef MADV_HUGEPAGE
+        if (madvise(mem, size, MADV_HUGEPAGE) == 0) {
+            *backing = POOL_BACKING_THP;
+        }
+#endif
+        return mem;
+    }
+    if (flags & POOL_MMAP) {
+        // anonymous pages are zero-filled and only committed on first touch, unless prefaulted
+#ifdef MAP_POPULATE
+        if (flags & POOL_PREFAULT) {
+            map_flags |= MAP_POPULATE;
+        }
+#endif
+        mem = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE, map_flags, -1, 0);
+        if (mem == MAP_FAILED) {
+            return NULL;
+        }
+        *backing = POOL_BACKING_MMAP;
+        return mem;
+    }
+#endif
+    // note: without mmap(), every pool lives on the heap
+    *backing = POOL_BACKING_HEAP;
+    return (char *) calloc(size, sizeof(char));
+}
+
+static void _mem_unmap_region(char *mem, size_t size, pool_backing backing) {
+    // an external buffer belongs to the caller
+    if (backing == POOL_BACKING_EXTERNAL) {
+        return;
+    }
+#ifdef MEM_HAVE_MMAP
+    if ((backing == POOL_BACKING_MMAP)
+        || (backing == POOL_BACKING_HUGETLB) || (backing == POOL_BACKING_THP)) {
+        munmap(mem, size);
+        return;
+    }
+    if (backing == POOL_BACKING_FILE) {
+        // the file header is mapped right in front of the pool
+        munmap(mem - MEM_FILE_HEADER_SIZE, MEM_FILE_HEADER_SIZE + size);
+        return;
+    }
+#endif
+    free(mem);
+}
+
+static alloc_status _mem_warm_region(char *mem, size_t size, unsigned flags) {
+#ifdef MEM_HAVE_MMAP
+    // locking faults every page in as well
+    if (flags & POOL_MLOCK) {
+        return (mlock(mem, size) == 0) ? ALLOC_OK : ALLOC_FAIL;
+    }
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+#else
+    size_t page_size = 4096;
+#endif
+    // touch every page, writing back what is there
+    // note: pages populated by mmap() are already in, and cost nothing here
+    if (flags & POOL_PREFAULT) {
+        volatile char *page = mem;
+        for (size_t offset = 0; offset < size; offset += page_size) {
+            page[offset] = page[offset];
+        }
+    }
+
+    return ALLOC_OK;
+}
+
+static void _mem_trim_gap(pool_mgr_pt pool_mgr, node_pt node) {
+#ifdef MEM_HAVE_MMAP
+    // huge pages can only be given back whole
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    if ((pool_mgr->backing == POOL_BACKING_HUGETLB) || (pool_mgr->backing == POOL_BACKING_THP)) {
+        page_size = MEM_HUGE_PAGE_SIZE;
+    }
+    // only the whole pages inside the gap can go
+    uintptr_t start = ((uintptr_t) node->alloc_record.mem + page_size - 1) & ~((uintptr_t) page_size - 1);
+    uintptr_t end = ((uintptr_t) node->alloc_record.mem + node->alloc_record.size) & ~((uintptr_t) page_size - 1);
+    if (end > start) {
+        // note: the pages stay mapped, and fault back in zero-filled when reused
+        madvise((void *) start, end - start, MADV_DONTNEED);
+    }
+#endif
 }
 
 static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
     if (((float) pool_mgr->used_nodes / pool_mgr->total_nodes) > MEM_NODE_HEAP_FILL_FACTOR) {
-        node_pt resize = realloc(pool_mgr->node_heap, pool_mgr->total_nodes*MEM_NODE_HEAP_EXPAND_FACTOR);
-        assert(resize);
-        pool_mgr->node_heap = resize;
-        pool_mgr->total_nodes = pool_mgr->total_nodes*MEM_NODE_HEAP_EXPAND_FACTOR;
-        return ALLOC_OK;
+        alloc_status status = _mem_expand_node_heap(pool_mgr, pool_mgr->total_nodes*MEM_NODE_HEAP_EXPAND_FACTOR);
+        assert(status == ALLOC_OK);
+        return status;
     }
 
     return ALLOC_FAIL;
@@ -487,21 +1804,92 @@ static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
 
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr) {
     if (((float) pool_mgr->pool.num_gaps / pool_mgr->gap_ix_capacity) > MEM_GAP_IX_FILL_FACTOR) {
-        gap_pt resize = realloc(pool_mgr->gap_ix, pool_mgr->gap_ix_capacity*MEM_GAP_IX_EXPAND_FACTOR);
-        assert(resize);
-        pool_mgr->gap_ix = resize;
-        pool_mgr->gap_ix_capacity = pool_mgr->gap_ix_capacity*MEM_GAP_IX_EXPAND_FACTOR;
-        return ALLOC_OK;
+        alloc_status status = _mem_expand_gap_ix(pool_mgr, pool_mgr->gap_ix_capacity*MEM_GAP_IX_EXPAND_FACTOR);
+        assert(status == ALLOC_OK);
+        return status;
     }
 
     return ALLOC_FAIL;
 }
 
-static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
-                                       size_t size,
-                                       node_pt node) {
-
-    // expand the gap index, if necessary (call the function)
+static alloc_status _mem_expand_node_heap(pool_mgr_pt pool_mgr, unsigned capacity) {
+    // add chunks until there are enough nodes
+    // note: the nodes never move, so the allocation records handed out stay valid,
+    //       and a chunk is published only once it is zeroed, for lock-free readers
+    while (pool_mgr->total_nodes < capacity) {
+        if (pool_mgr->num_chunks == MEM_NODE_HEAP_CHUNKS) {
+            return ALLOC_FAIL;
+        }
+        unsigned chunk_capacity = MEM_NODE_HEAP_INIT_CAPACITY;
+        for (unsigned k = 0; k < pool_mgr->num_chunks; k++) {
+            chunk_capacity *= MEM_NODE_HEAP_EXPAND_FACTOR;
+        }
+        node_pt chunk = (node_pt) calloc(chunk_capacity, sizeof(node_t));
+        if (chunk == NULL) {
+            return ALLOC_FAIL;
+        }
+        atomic_store_explicit(&pool_mgr->node_chunks[pool_mgr->num_chunks], chunk, memory_order_release);
+        pool_mgr->num_chunks += 1;
+        pool_mgr->total_nodes += chunk_capacity;
+    }
+
+    return ALLOC_OK;
+}
+
+static node_pt _mem_node_at(pool_mgr_pt pool_mgr, unsigned ix) {
+    // find the chunk the node is in
+    unsigned chunk = 0;
+    unsigned chunk_capacity = MEM_NODE_HEAP_INIT_CAPACITY;
+    while (ix >= chunk_capacity) {
+        ix -= chunk_capacity;
+        chunk_capacity *= MEM_NODE_HEAP_EXPAND_FACTOR;
+        if (++chunk == pool_mgr->num_chunks) {
+            return NULL;
+        }
+    }
+
+    return &pool_mgr->node_chunks[chunk][ix];
+}
+
+// note: called without the pool's lock, e.g. to queue a remote free, so only the
+//       published chunks are read
+static int _mem_owns_node(pool_mgr_pt pool_mgr, node_pt node) {
+    // the address tells, no need to scan the chunks' nodes
+    unsigned chunk_capacity = MEM_NODE_HEAP_INIT_CAPACITY;
+    for (unsigned chunk = 0; chunk < MEM_NODE_HEAP_CHUNKS; chunk++) {
+        node_pt nodes = atomic_load_explicit(&pool_mgr->node_chunks[chunk], memory_order_acquire);
+        if (nodes == NULL) {
+            break;
+        }
+        uintptr_t offset = (uintptr_t) node - (uintptr_t) nodes;
+        if (offset < chunk_capacity * sizeof(node_t)) {
+            return (offset % sizeof(node_t) == 0);
+        }
+        chunk_capacity *= MEM_NODE_HEAP_EXPAND_FACTOR;
+    }
+
+    return 0;
+}
+
+static alloc_status _mem_expand_gap_ix(pool_mgr_pt pool_mgr, unsigned capacity) {
+    if (capacity <= pool_mgr->gap_ix_capacity) {
+        return ALLOC_OK;
+    }
+    gap_pt resize = (gap_pt) realloc(pool_mgr->gap_ix, capacity * sizeof(gap_t));
+    if (resize == NULL) {
+        return ALLOC_FAIL;
+    }
+    pool_mgr->gap_ix = resize;
+    pool_mgr->gap_ix_capacity = capacity;
+
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
+                                       size_t size,
+                                       node_pt node) {
+
+    // expand the gap index, if necessary (call the function)
     _mem_resize_gap_ix(pool_mgr);
     // add the entry at the end
     gap_t new_gap;
@@ -569,4 +1957,1331 @@ static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
     return ALLOC_OK;
 }
 
+static node_pt _mem_get_unused_node(pool_mgr_pt pool_mgr) {
+    // find an unused one in the node heap, chunk by chunk
+    unsigned chunk_capacity = MEM_NODE_HEAP_INIT_CAPACITY;
+    for (unsigned chunk = 0; chunk < pool_mgr->num_chunks; chunk++) {
+        node_pt nodes = pool_mgr->node_chunks[chunk];
+        for (unsigned i = 0; i < chunk_capacity; i++) {
+            if (nodes[i].used == 0) {
+                return &nodes[i];
+            }
+        }
+        chunk_capacity *= MEM_NODE_HEAP_EXPAND_FACTOR;
+    }
+
+    return NULL;
+}
+
+static inline void _mem_lock(pool_mgr_pt pool_mgr) {
+    // an unlocked pool only pays for this test
+    if (!(pool_mgr->flags & (POOL_LOCK_SPIN | POOL_LOCK_MUTEX))) {
+        return;
+    }
+#ifdef MEM_HAVE_PTHREADS
+    if (pool_mgr->flags & POOL_LOCK_MUTEX) {
+        pthread_mutex_lock(&pool_mgr->mutex);
+        _mem_seq_begin(pool_mgr);
+        return;
+    }
+#endif
+    // spin on a plain load, so that waiting threads don't keep taking the cache line
+    while (atomic_exchange_explicit(&pool_mgr->spin, 1, memory_order_acquire)) {
+        while (atomic_load_explicit(&pool_mgr->spin, memory_order_relaxed)) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+    _mem_seq_begin(pool_mgr);
+}
+
+static inline int _mem_trylock(pool_mgr_pt pool_mgr) {
+#ifdef MEM_HAVE_PTHREADS
+    if (pool_mgr->flags & POOL_LOCK_MUTEX) {
+        if (pthread_mutex_trylock(&pool_mgr->mutex) != 0) {
+            return 0;
+        }
+        _mem_seq_begin(pool_mgr);
+        return 1;
+    }
+#endif
+    if (atomic_exchange_explicit(&pool_mgr->spin, 1, memory_order_acquire)) {
+        return 0;
+    }
+    _mem_seq_begin(pool_mgr);
+
+    return 1;
+}
+
+static inline void _mem_seq_begin(pool_mgr_pt pool_mgr) {
+    // tell snapshots that the pool is changing, before it does
+    // note: only the lock holder writes the sequence number
+    unsigned seq = atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed);
+    atomic_store_explicit(&pool_mgr->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void _mem_unlock(pool_mgr_pt pool_mgr) {
+    if (!(pool_mgr->flags & (POOL_LOCK_SPIN | POOL_LOCK_MUTEX))) {
+        return;
+    }
+    // publish the largest gap, the index is sorted by size
+    // note: the line is only written when it changes, so readers' copies stay valid
+    size_t largest = (pool_mgr->pool.num_gaps > 0) ? pool_mgr->gap_ix[pool_mgr->pool.num_gaps - 1].size : 0;
+    if (atomic_load_explicit(&pool_mgr->largest_gap, memory_order_relaxed) != largest) {
+        atomic_store_explicit(&pool_mgr->largest_gap, largest, memory_order_relaxed);
+    }
+    // the pool is consistent again
+    unsigned seq = atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed);
+    atomic_store_explicit(&pool_mgr->seq, seq + 1, memory_order_release);
+#ifdef MEM_HAVE_PTHREADS
+    if (pool_mgr->flags & POOL_LOCK_MUTEX) {
+        pthread_mutex_unlock(&pool_mgr->mutex);
+        return;
+    }
+#endif
+    atomic_store_explicit(&pool_mgr->spin, 0, memory_order_release);
+}
+
+static alloc_pt _mem_new_alloc(pool_mgr_pt pool_mgr, size_t size, size_t alignment) {
+    // alignment has to be a power of two
+    if ((alignment == 0) || (alignment & (alignment - 1))) {
+        return NULL;
+    }
+    // a shared pool hands out offsets only, see mem_shared_alloc
+    if (pool_mgr->backing == POOL_BACKING_SHARED) {
+        return NULL;
+    }
+    // blocks other threads freed to this shard are reused first
+    _mem_drain_remote(pool_mgr);
+    // round up to the size class, if configured
+    size = _mem_round_size(pool_mgr, size);
+    // a block freed at the same size can be handed back as is
+    if (pool_mgr->pending_count > 0) {
+        alloc_pt reused = _mem_reuse_pending(pool_mgr, size, alignment);
+        if (reused) {
+            return reused;
+        }
+    }
+    // check if any gaps, return null if none
+    // note: a growable or remapped pool can always get bigger instead
+    if ((pool_mgr->pool.num_gaps == 0) && (pool_mgr->pending_count == 0)
+        && !(pool_mgr->flags & (POOL_GROWABLE | POOL_REMAP))) {
+        return NULL;
+    }
+    // expand heap node, if necessary, quit on error
+    // note: an aligned allocation may need two new nodes (padding and remainder)
+    _mem_resize_node_heap(pool_mgr);
+    // check used nodes fewer than total nodes, quit on error
+    assert(pool_mgr->used_nodes + 1 < pool_mgr->total_nodes);
+    // get a node for allocation, along with the padding in front of it
+    size_t pad = 0;
+    node_pt suf_node = NULL;
+    // large allocations in huge page pools preferably start on a huge page
+    if (((pool_mgr->backing == POOL_BACKING_HUGETLB) || (pool_mgr->backing == POOL_BACKING_THP))
+        && (size >= MEM_HUGE_PAGE_SIZE) && (alignment < MEM_HUGE_PAGE_SIZE)) {
+        suf_node = _mem_find_gap(pool_mgr, size, MEM_HUGE_PAGE_SIZE, &pad);
+    }
+    if (suf_node == NULL) {
+        suf_node = _mem_find_gap(pool_mgr, size, alignment, &pad);
+    }
+    // no fit may just mean the fitting gaps are still queued, so coalesce and retry
+    if ((suf_node == NULL) && (pool_mgr->pending_count > 0)) {
+        _mem_flush_pending(pool_mgr);
+        suf_node = _mem_find_gap(pool_mgr, size, alignment, &pad);
+    }
+    // a growable or remapped pool gets bigger, so that it is sure to fit
+    if ((suf_node == NULL) && (_mem_extend_pool(pool_mgr, size + alignment - 1) == ALLOC_OK)) {
+        suf_node = _mem_find_gap(pool_mgr, size, alignment, &pad);
+    }
+    // check if node found
+    if (suf_node == NULL) {
+        return NULL;
+    }
+    // carve the allocation out of the gap
+    return _mem_carve_gap(pool_mgr, suf_node, pad, size);
+}
+
+static alloc_pt _mem_new_alloc_near(pool_mgr_pt pool_mgr, size_t size, node_pt hint_node) {
+    // without a live hint, there is nothing to be near
+    // note: the hint is checked the way a free is, before it is dereferenced
+    if ((hint_node == NULL) || !_mem_owns_node(pool_mgr, hint_node)
+        || (hint_node->used == 0) || (hint_node->allocated == 0)) {
+        return _mem_new_alloc(pool_mgr, size, 1);
+    }
+    _mem_drain_remote(pool_mgr);
+    // round up to the size class, if configured
+    size = _mem_round_size(pool_mgr, size);
+    // expand heap node, if necessary, quit on error
+    _mem_resize_node_heap(pool_mgr);
+    // check used nodes fewer than total nodes, quit on error
+    assert(pool_mgr->used_nodes + 1 < pool_mgr->total_nodes);
+    // get the nearest sufficient gap, along with the padding in front of the allocation
+    size_t pad = 0;
+    node_pt suf_node = _mem_find_gap_near(hint_node, size, &pad);
+    // no fit may just mean the fitting gaps are still queued, so coalesce and retry
+    if ((suf_node == NULL) && (pool_mgr->pending_count > 0)) {
+        _mem_flush_pending(pool_mgr);
+        suf_node = _mem_find_gap_near(hint_node, size, &pad);
+    }
+    // a growable or remapped pool gets bigger at the end, which is as near as it gets
+    if ((suf_node == NULL) && (_mem_extend_pool(pool_mgr, size) == ALLOC_OK)) {
+        suf_node = _mem_find_gap(pool_mgr, size, 1, &pad);
+    }
+    // check if node found
+    if (suf_node == NULL) {
+        return NULL;
+    }
+    // carve the allocation out of the gap
+    return _mem_carve_gap(pool_mgr, suf_node, pad, size);
+}
+
+static alloc_status _mem_del_alloc(pool_mgr_pt pool_mgr, node_pt del_node) {
+    // make sure it's an allocation in the node heap
+    if (!_mem_owns_node(pool_mgr, del_node) || (del_node->used == 0) || (del_node->allocated == 0)) {
+        return ALLOC_FAIL;
+    }
+    // if deferring frees and the queue is full, coalesce it in bulk first
+    if ((pool_mgr->pending_threshold > 0) && (pool_mgr->pending_count == pool_mgr->pending_threshold)) {
+        _mem_flush_pending(pool_mgr);
+    }
+    // convert to gap node
+    del_node->allocated = 0;
+    // update metadata (num_allocs, alloc_size)
+    pool_mgr->pool.num_allocs -= 1;
+    pool_mgr->pool.alloc_size -= del_node->alloc_record.size;
+    // if deferring frees, just queue the node for a later bulk coalesce
+    if (pool_mgr->pending_threshold > 0) {
+        del_node->pending = 1;
+        pool_mgr->pending_q[pool_mgr->pending_count] = del_node;
+        pool_mgr->pending_count += 1;
+        return ALLOC_OK;
+    }
+    // merge with the neighboring gaps and add to the gap index
+    return _mem_coalesce_gap(pool_mgr, del_node);
+}
+
+// note: the padding is the distance from the gap start to the next aligned address
+static node_pt _mem_find_gap(pool_mgr_pt pool_mgr,
+                             size_t size,
+                             size_t alignment,
+                             size_t *pad) {
+    // if FIRST_FIT, then find the first sufficient node in pool order
+    // note: the list starts at the top node, and runs through the regions in the order they were added
+    if (pool_mgr->pool.policy == FIRST_FIT) {
+        for (node_pt node = pool_mgr->node_heap; node; node = node->next) {
+            if ((node->allocated == 0) && (node->pending == 0)) {
+                size_t node_pad = (alignment - ((uintptr_t) node->alloc_record.mem & (alignment - 1)))
+                                  & (alignment - 1);
+                if (node->alloc_record.size >= node_pad + size) {
+                    *pad = node_pad;
+                    return node;
+                }
+            }
+        }
+    }
+    // if BEST_FIT, then find the first sufficient node in the gap index
+    else if (pool_mgr->pool.policy == BEST_FIT) {
+        for (int i = 0; i < pool_mgr->pool.num_gaps; i++) {
+            node_pt node = pool_mgr->gap_ix[i].node;
+            size_t node_pad = (alignment - ((uintptr_t) node->alloc_record.mem & (alignment - 1)))
+                              & (alignment - 1);
+            if (pool_mgr->gap_ix[i].size >= node_pad + size) {
+                *pad = node_pad;
+                return node;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static alloc_pt _mem_carve_gap(pool_mgr_pt pool_mgr,
+                               node_pt gap_node,
+                               size_t pad,
+                               size_t size) {
+    alloc_status status;
+    // calculate the size of the remaining gap, if any
+    size_t r_size = gap_node->alloc_record.size - pad - size;
+    // remove node from gap index
+    status = _mem_remove_from_gap_ix(pool_mgr, gap_node->alloc_record.size, gap_node);
+    assert(status == ALLOC_OK);
+    // get the node for the allocation:
+    node_pt alloc_node = gap_node;
+    if (pad > 0) {
+        //   the leading padding stays behind as a gap, so need a new node
+        alloc_node = _mem_get_unused_node(pool_mgr);
+        assert(alloc_node);
+        alloc_node->used = 1;
+        alloc_node->alloc_record.mem = gap_node->alloc_record.mem + pad;
+        //   update metadata (used_nodes)
+        pool_mgr->used_nodes += 1;
+        //   update linked list (new node right after the padding gap)
+        alloc_node->next = gap_node->next;
+        if (gap_node->next) {
+            gap_node->next->prev = alloc_node;
+        }
+        gap_node->next = alloc_node;
+        alloc_node->prev = gap_node;
+        //   shrink the padding gap and put it back in the gap index
+        gap_node->alloc_record.size = pad;
+        status = _mem_add_to_gap_ix(pool_mgr, pad, gap_node);
+        assert(status == ALLOC_OK);
+    }
+    // convert to an allocation node of given size
+    alloc_node->allocated = 1;
+    alloc_node->alloc_record.size = size;
+    // update metadata (num_allocs, alloc_size)
+    pool_mgr->pool.num_allocs += 1;
+    pool_mgr->pool.alloc_size += size;
+    // the allocation may be written to, so it is no longer known to be zero
+    char *region_mem = pool_mgr->pool.mem;
+    size_t *zero_top = &pool_mgr->zero_top;
+    region_pt region = _mem_find_region(pool_mgr, alloc_node->alloc_record.mem);
+    if (region) {
+        region_mem = region->mem;
+        zero_top = &region->zero_top;
+    }
+    size_t offset = alloc_node->alloc_record.mem - region_mem;
+    pool_mgr->last_dirty = 0;
+    if (offset < *zero_top) {
+        pool_mgr->last_dirty = (*zero_top - offset < size) ? *zero_top - offset : size;
+    }
+    if (offset + size > *zero_top) {
+        *zero_top = offset + size;
+    }
+    // adjust node heap:
+    if (r_size > 0) {
+        //   if remaining gap, need a new node
+        node_pt unused_node = _mem_get_unused_node(pool_mgr);
+        //   make sure one was found
+        assert(unused_node);
+        //   initialize it to a gap node
+        unused_node->used = 1;
+        unused_node->allocated = 0;
+        unused_node->alloc_record.size = r_size;
+        unused_node->alloc_record.mem = alloc_node->alloc_record.mem + size*sizeof(char);
+        //   update metadata (used_nodes)
+        pool_mgr->used_nodes += 1;
+        //   update linked list (new node right after the node for allocation)
+        unused_node->next = alloc_node->next;
+        if (alloc_node->next) {
+            alloc_node->next->prev = unused_node;
+        }
+        alloc_node->next = unused_node;
+        unused_node->prev = alloc_node;
+        //   add to gap index
+        status = _mem_add_to_gap_ix(pool_mgr, unused_node->alloc_record.size, unused_node);
+        assert(status == ALLOC_OK);
+    }
+    // return allocation record by casting the node to (alloc_pt)
+    return (alloc_pt) alloc_node;
+}
+
+static alloc_status _mem_coalesce_gap(pool_mgr_pt pool_mgr, node_pt node) {
+    node_pt node_to_add = NULL;
+
+    // if the next node in the list is also a gap, merge into node-to-free
+    // note: pending gaps are not in the gap index, so leave them alone,
+    //       and gaps in different regions are not contiguous
+    if ((node->next) && (node->next->allocated == 0) && (node->next->pending == 0)
+        && (_mem_find_region(pool_mgr, node->next->alloc_record.mem) == _mem_find_region(pool_mgr, node->alloc_record.mem))) {
+        //   remove the next node from gap index
+        node_pt next_node = node->next;
+        size_t next_node_size = next_node->alloc_record.size;
+        assert(_mem_remove_from_gap_ix(pool_mgr, next_node_size, next_node) == ALLOC_OK);
+        //   check success
+        //   add the size to the node-to-free
+        node->alloc_record.size += next_node_size;
+        //   update node as unused
+        next_node->used = 0;
+        //   update metadata (used nodes)
+        pool_mgr->used_nodes -= 1;
+        //   update linked list:
+        if (next_node->next) {
+            next_node->next->prev = node;
+            node->next = next_node->next;
+        }
+        else {
+            node->next = NULL;
+        }
+        next_node->next = NULL;
+        next_node->prev = NULL;
+        /*
+                        if (next->next) {
+                            next->next->prev = node_to_del;
+                            node_to_del->next = next->next;
+                        } else {
+                            node_to_del->next = NULL;
+                        }
+                        next->next = NULL;
+                        next->prev = NULL;
+         */
+        node_to_add = node;
+    }
+    // this merged node-to-free might need to be added to the gap index
+    // but one more thing to check...
+    // if the previous node in the list is also a gap, merge into previous!
+    if ((node->prev) && (node->prev->allocated == 0) && (node->prev->pending == 0)
+        && (_mem_find_region(pool_mgr, node->prev->alloc_record.mem) == _mem_find_region(pool_mgr, node->alloc_record.mem))) {
+        //   remove the previous node from gap index
+        node_pt prev_node = node->prev;
+        size_t prev_node_size = prev_node->alloc_record.size;
+        assert(_mem_remove_from_gap_ix(pool_mgr, prev_node_size, prev_node) == ALLOC_OK);
+        //   check success
+        //   add the size of node-to-free to the previous
+        prev_node->alloc_record.size += node->alloc_record.size;
+        //   update node-to-free as unused
+        node->used = 0;
+        //   update metadata (used_nodes)
+        pool_mgr->used_nodes -= 1;
+        //   update linked list
+        if (node->next) {
+            prev_node->next = node->next;
+            node->next->prev = prev_node;
+        }
+        else {
+            prev_node->next = NULL;
+        }
+        node->next = NULL;
+        node->prev = NULL;
+        /*
+                        if (node_to_del->next) {
+                            prev->next = node_to_del->next;
+                            node_to_del->next->prev = prev;
+                        } else {
+                            prev->next = NULL;
+                        }
+                        node_to_del->next = NULL;
+                        node_to_del->prev = NULL;
+         */
+        //prev_node->next->alloc_record.mem = prev_node->alloc_record.mem + prev_node->alloc_record.size*sizeof(char);
+        node_to_add = prev_node;
+    }
+    //   change the node to add to the previous node!
+
+    // add the resulting node to the gap index
+    if (node_to_add) {
+        assert(_mem_add_to_gap_ix(pool_mgr, node_to_add->alloc_record.size, node_to_add) == ALLOC_OK);
+    }
+    else {
+        assert(_mem_add_to_gap_ix(pool_mgr, node->alloc_record.size, node) == ALLOC_OK);
+        node_to_add = node;
+    }
+    // check success
+    // a large enough gap gives its pages back to the OS
+    // note: with a maintenance thread, that is done off the free path
+    if ((pool_mgr->trim_threshold > 0) && (node_to_add->alloc_record.size >= pool_mgr->trim_threshold)) {
+        if (atomic_load_explicit(&pool_mgr->maintained, memory_order_relaxed)
+            && atomic_load_explicit(&maint_running, memory_order_relaxed)) {
+            pool_mgr->trim_due = 1;
+        }
+        else {
+            _mem_trim_gap(pool_mgr, node_to_add);
+        }
+    }
+
+    return ALLOC_OK;
+}
+
+static void _mem_flush_pending(pool_mgr_pt pool_mgr) {
+    // coalesce the queued nodes in the order they were freed
+    for (unsigned u = 0; u < pool_mgr->pending_count; u++) {
+        node_pt node = pool_mgr->pending_q[u];
+        node->pending = 0;
+        _mem_coalesce_gap(pool_mgr, node);
+        pool_mgr->pending_q[u] = NULL;
+    }
+    pool_mgr->pending_count = 0;
+}
+
+// note: producers only ever push, and the queue is taken whole, so a node cannot
+//       come back to the head between a producer's load and its compare-and-swap unnoticed
+static void _mem_drain_remote(pool_mgr_pt pool_mgr) {
+    // an empty queue costs a load, and no cache line is written
+    if (atomic_load_explicit(&pool_mgr->remote_q, memory_order_relaxed) == NULL) {
+        return;
+    }
+    node_pt node = atomic_exchange_explicit(&pool_mgr->remote_q, NULL, memory_order_acquire);
+    while (node) {
+        // the link is read before the node can be coalesced away
+        node_pt next = atomic_load_explicit(&node->remote_next, memory_order_relaxed);
+        alloc_status status = _mem_del_alloc(pool_mgr, node);
+        assert(status == ALLOC_OK);
+        atomic_store_explicit(&node->remote_next, NULL, memory_order_relaxed);
+        atomic_store_explicit(&node->remote, 0, memory_order_release);
+        node = next;
+    }
+}
+
+// note: the reader copies the list without the lock, and keeps the copy only if the
+//       sequence number was even and unchanged across it, so no writer ever waits for it;
+//       the nodes it may be reading are never moved or freed until the pool is closed
+MEM_SEQLOCK_READER
+static alloc_status _mem_snapshot_mgr(pool_mgr_pt pool_mgr,
+                                      pool_t *stats,
+                                      pool_segment_pt *segments,
+                                      unsigned *num_segments) {
+    pool_segment_pt segs = NULL;
+    unsigned capacity = 0;
+    for (;;) {
+        unsigned seq = atomic_load_explicit(&pool_mgr->seq, memory_order_acquire);
+        if (seq & 1) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            continue;
+        }
+        // make room for the list as it is now, outside of the copy
+        unsigned count = pool_mgr->used_nodes;
+        if (count > capacity) {
+            pool_segment_pt more = (pool_segment_pt) realloc(segs, count * sizeof(pool_segment_t));
+            if (more == NULL) {
+                free(segs);
+                return ALLOC_FAIL;
+            }
+            segs = more;
+            capacity = count;
+            continue;
+        }
+        // copy the list and the counters
+        // note: a torn list may be longer than it claims, or even loop, so the walk is bounded
+        unsigned i = 0;
+        for (node_pt node = pool_mgr->node_heap; node && (i <= count); node = node->next) {
+            if (i < count) {
+                segs[i].size = node->alloc_record.size;
+                segs[i].allocated = node->allocated;
+            }
+            i++;
+        }
+        pool_t copy = pool_mgr->pool;
+        atomic_thread_fence(memory_order_acquire);
+        if ((i == count) && (atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed) == seq)) {
+            *stats = copy;
+            *segments = segs;
+            *num_segments = count;
+            return ALLOC_OK;
+        }
+    }
+}
+
+static alloc_pt _mem_reuse_pending(pool_mgr_pt pool_mgr,
+                                   size_t size,
+                                   size_t alignment) {
+    // look for an exact fit, most recently freed first
+    for (unsigned u = pool_mgr->pending_count; u > 0; u--) {
+        node_pt node = pool_mgr->pending_q[u - 1];
+        if ((node->alloc_record.size == size)
+            && (((uintptr_t) node->alloc_record.mem & (alignment - 1)) == 0)) {
+            //   take it off the queue by moving the last entry into its place
+            pool_mgr->pending_count -= 1;
+            pool_mgr->pending_q[u - 1] = pool_mgr->pending_q[pool_mgr->pending_count];
+            pool_mgr->pending_q[pool_mgr->pending_count] = NULL;
+            //   turn it back into an allocation, no split or merge needed
+            node->pending = 0;
+            node->allocated = 1;
+            pool_mgr->last_dirty = size;
+            //   update metadata (num_allocs, alloc_size)
+            pool_mgr->pool.num_allocs += 1;
+            pool_mgr->pool.alloc_size += size;
+            return (alloc_pt) node;
+        }
+    }
+
+    return NULL;
+}
+
+static thread_cache_pt _mem_thread_cache(pool_mgr_pt pool_mgr, int create) {
+    // find this thread's entry for the pool
+    thread_cache_pt free_cache = NULL;
+    for (unsigned u = 0; u < MEM_THREAD_CACHE_POOLS; u++) {
+        thread_cache_pt cache = &thread_caches[u];
+        if ((cache->pool_mgr == pool_mgr) && (cache->store_ix == pool_mgr->store_ix)) {
+            return cache;
+        }
+        if ((cache->pool_mgr == NULL) && (free_cache == NULL)) {
+            free_cache = cache;
+        }
+    }
+    // or take a free one
+    if (create && free_cache) {
+        memset(free_cache, 0, sizeof(thread_cache_t));
+        free_cache->pool_mgr = pool_mgr;
+        free_cache->store_ix = pool_mgr->store_ix;
+        return free_cache;
+    }
+
+    return NULL;
+}
+
+static int _mem_thread_cache_bin(thread_cache_pt cache, size_t size, int create) {
+    // find the bin for the size, or a free bin to take
+    int free_bin = -1;
+    for (int bin = 0; bin < MEM_THREAD_CACHE_BINS; bin++) {
+        if ((cache->sizes[bin] == size) && (size > 0)) {
+            return bin;
+        }
+        if ((cache->counts[bin] == 0) && (free_bin < 0)) {
+            free_bin = bin;
+        }
+    }
+    if (create && (free_bin >= 0)) {
+        cache->sizes[free_bin] = size;
+        return free_bin;
+    }
+
+    return -1;
+}
+
+static void _mem_thread_cache_drain(thread_cache_pt cache, int bin, unsigned count) {
+    if (count == 0) {
+        return;
+    }
+    // free the oldest blocks, at the bottom of the bin
+    _mem_lock(cache->pool_mgr);
+    for (unsigned u = 0; u < count; u++) {
+        cache->blocks[bin][u]->cached = 0;
+        alloc_status status = _mem_del_alloc(cache->pool_mgr, cache->blocks[bin][u]);
+        assert(status == ALLOC_OK);
+        (void) status;
+    }
+    _mem_unlock(cache->pool_mgr);
+    // and move the rest down
+    cache->counts[bin] -= count;
+    memmove(&cache->blocks[bin][0], &cache->blocks[bin][count], cache->counts[bin] * sizeof(node_pt));
+    if (cache->counts[bin] == 0) {
+        cache->sizes[bin] = 0;
+    }
+}
+
+// note: threads take shard numbers in turn, so n threads spread over n shards of every sharded pool
+static pool_mgr_pt _mem_shard_for_thread(pool_mgr_pt pool_mgr) {
+    if (thread_shard == 0) {
+        thread_shard = atomic_fetch_add_explicit(&shard_next, 1, memory_order_relaxed) + 1;
+    }
+    unsigned home = (thread_shard - 1) % pool_mgr->num_shards;
+    // a striped pool takes the first stripe from there that no thread holds right now
+    // note: the lock may be taken by the time the thread gets to it, which only costs a wait
+    if (pool_mgr->striped) {
+        for (unsigned u = 0; u < pool_mgr->num_shards; u++) {
+            pool_mgr_pt stripe = pool_mgr->shards[(home + u) % pool_mgr->num_shards];
+            if (!atomic_load_explicit(&stripe->spin, memory_order_relaxed)) {
+                return stripe;
+            }
+        }
+    }
+
+    return pool_mgr->shards[home];
+}
+
+static pool_mgr_pt _mem_shard_for_mem(pool_mgr_pt pool_mgr, char *mem) {
+    // a pointer outside the pool goes to the first shard, which rejects it
+    if ((mem < pool_mgr->pool.mem) || (mem >= pool_mgr->pool.mem + pool_mgr->pool.total_size)) {
+        return pool_mgr->shards[0];
+    }
+    // the last shard also holds the remainder past the even slices
+    size_t ix = (size_t) (mem - pool_mgr->pool.mem) / pool_mgr->shard_size;
+    if (ix >= pool_mgr->num_shards) {
+        ix = pool_mgr->num_shards - 1;
+    }
+
+    return pool_mgr->shards[ix];
+}
+
+// note: the summaries are read without the locks, so they may be stale, and a steal can still fail
+static pool_mgr_pt _mem_shard_victim(pool_mgr_pt pool_mgr, pool_mgr_pt home, size_t size) {
+    pool_mgr_pt victim = NULL;
+    pool_mgr_pt queued = NULL;
+    size_t most = 0;
+    for (unsigned u = 0; u < pool_mgr->num_shards; u++) {
+        pool_mgr_pt shard = pool_mgr->shards[u];
+        if (shard == home) {
+            continue;
+        }
+        size_t largest = atomic_load_explicit(&shard->largest_gap, memory_order_relaxed);
+        if ((largest >= size) && (largest > most)) {
+            victim = shard;
+            most = largest;
+        }
+        if ((queued == NULL) && atomic_load_explicit(&shard->remote_q, memory_order_relaxed)) {
+            queued = shard;
+        }
+    }
+    // blocks freed from other threads are not in the summary until the shard drains them,
+    // which the steal does first
+    return (victim) ? victim : queued;
+}
+
+static void _mem_maint_set(pool_mgr_pt pool_mgr, int on) {
+#ifdef MEM_HAVE_PTHREADS
+    // note: only a locked pool can be touched by another thread
+    int locked = (pool_mgr->flags & (POOL_LOCK_SPIN | POOL_LOCK_MUTEX)) != 0;
+    atomic_store(&pool_mgr->maintained, on && locked);
+    for (unsigned u = 0; u < pool_mgr->num_shards; u++) {
+        atomic_store(&pool_mgr->shards[u]->maintained, on);
+    }
+    // once off, wait out a pass that may be in the pool, or its shards, right now
+    if (!on) {
+        _mem_maint_wait(pool_mgr);
+        for (unsigned u = 0; u < pool_mgr->num_shards; u++) {
+            _mem_maint_wait(pool_mgr->shards[u]);
+        }
+    }
+#else
+    (void) pool_mgr;
+    (void) on;
+#endif
+}
+
+// note: a pass publishes the pool it is about to enter, and then checks the pool's
+//       slot and flag again, while a closing thread clears them first, and then
+//       checks the pass, so one of the two always sees the other
+static void _mem_maint_wait(pool_mgr_pt pool_mgr) {
+#ifdef MEM_HAVE_PTHREADS
+    // a pass only stays in a pool for one round of maintenance
+    while (atomic_load(&maint_visiting) == pool_mgr) {
+        sched_yield();
+    }
+#else
+    (void) pool_mgr;
+#endif
+}
+
+static void _mem_maintain(pool_mgr_pt pool_mgr) {
+    // frees from other threads, and deferred frees, become gaps
+    _mem_drain_remote(pool_mgr);
+    _mem_flush_pending(pool_mgr);
+    // the node heap and the gap index grow before an allocation or a free would have to grow them
+    _mem_resize_node_heap(pool_mgr);
+    _mem_resize_gap_ix(pool_mgr);
+    // the large gaps give their pages back, largest first
+    if (pool_mgr->trim_due) {
+        for (int i = pool_mgr->pool.num_gaps - 1;
+             (i >= 0) && (pool_mgr->gap_ix[i].size >= pool_mgr->trim_threshold); i--) {
+            _mem_trim_gap(pool_mgr, pool_mgr->gap_ix[i].node);
+        }
+        pool_mgr->trim_due = 0;
+    }
+}
+
+#ifdef MEM_HAVE_PTHREADS
+static void *_mem_maint_main(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&maint_mutex);
+    while (atomic_load(&maint_running)) {
+        // sleep for the interval, or until mem_free wakes the thread up
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += maint_interval_ms / 1000;
+        wake.tv_nsec += (long) (maint_interval_ms % 1000) * 1000000;
+        if (wake.tv_nsec >= 1000000000) {
+            wake.tv_sec += 1;
+            wake.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&maint_cond, &maint_mutex, &wake);
+        pthread_mutex_unlock(&maint_mutex);
+        // visit every locked pool whose lock is free, and skip the busy ones until the next pass
+        // note: the mgr may be closed until the pass is published, so it is only read after
+        unsigned size = atomic_load(&pool_store_size);
+        for (unsigned u = 0; (u < size) && atomic_load(&maint_running); u++) {
+            pool_slot_pt slot = _mem_pool_store_slot(u, 0);
+            pool_mgr_pt mgr = (slot) ? atomic_load(slot) : NULL;
+            if (mgr == NULL) {
+                continue;
+            }
+            atomic_store(&maint_visiting, mgr);
+            if ((atomic_load(slot) == mgr) && atomic_load(&mgr->maintained) && _mem_trylock(mgr)) {
+                _mem_maintain(mgr);
+                _mem_unlock(mgr);
+            }
+            atomic_store(&maint_visiting, NULL);
+        }
+        pthread_mutex_lock(&maint_mutex);
+    }
+    pthread_mutex_unlock(&maint_mutex);
+
+    return NULL;
+}
+#endif
+
+static size_t _mem_round_size(pool_mgr_pt pool_mgr, size_t size) {
+    // check if rounding is on
+    if (pool_mgr->class_quantum == 0) {
+        return size;
+    }
+    // small sizes go in quantum steps
+    size_t step = pool_mgr->class_quantum;
+    if (size > pool_mgr->class_small_max) {
+        //   larger sizes go in class_steps steps between consecutive powers of two
+        size_t power = 1;
+        while (power <= size / 2) {
+            power *= 2;
+        }
+        if (power / pool_mgr->class_steps > step) {
+            step = power / pool_mgr->class_steps;
+        }
+    }
+    size_t rounded = ((size + step - 1) / step) * step;
+    // don't let rounding overflow
+    return (rounded < size) ? size : rounded;
+}
+
+// note: the list is in address order, so the first fit in each direction is the nearest one
+static node_pt _mem_find_gap_near(node_pt hint_node,
+                                  size_t size,
+                                  size_t *pad) {
+    node_pt before = hint_node->prev;
+    node_pt after = hint_node->next;
+    node_pt found = NULL;
+    size_t found_dist = 0;
+    char *hint_start = hint_node->alloc_record.mem;
+    char *hint_end = hint_start + hint_node->alloc_record.size;
+
+    // walk outward in both directions, one node at a time
+    while (before || after) {
+        if (after) {
+            size_t dist = after->alloc_record.mem - hint_end;
+            if (found && (dist >= found_dist)) {
+                //   can't get any closer on this side
+                after = NULL;
+            }
+            else if ((after->allocated == 0) && (after->pending == 0)
+                     && (after->alloc_record.size >= size)) {
+                //   allocate from the start of a gap after the hint
+                found = after;
+                found_dist = dist;
+                *pad = 0;
+                after = NULL;
+            }
+            else {
+                after = after->next;
+            }
+        }
+        if (before) {
+            size_t dist = hint_start - (before->alloc_record.mem + before->alloc_record.size);
+            if (found && (dist >= found_dist)) {
+                //   can't get any closer on this side
+                before = NULL;
+            }
+            else if ((before->allocated == 0) && (before->pending == 0)
+                     && (before->alloc_record.size >= size)) {
+                //   allocate from the end of a gap before the hint
+                found = before;
+                found_dist = dist;
+                *pad = before->alloc_record.size - size;
+                before = NULL;
+            }
+            else {
+                before = before->prev;
+            }
+        }
+    }
+
+    return found;
+}
+
+#ifdef MEM_HAVE_MMAP
+static alloc_status _mem_shared_lock(pool_mgr_pt pool_mgr) {
+    pool_shared_header_pt header = pool_mgr->shared;
+    int status = pthread_mutex_lock(&header->lock);
+#ifdef __linux__
+    // the previous owner died holding the lock, maybe halfway through a change
+    // note: entries are moved before the counters are updated, so the table is
+    //       only taken if it still tiles the pool, and the counters are recounted;
+    //       otherwise the lock is given up inconsistent, and can't be taken again
+    if (status == EOWNERDEAD) {
+        pool_file_segment_pt table = (pool_file_segment_pt) (header + 1);
+        if ((header->num_segments > header->capacity)
+            || (_mem_check_segments(table, header->num_segments, header->total_size) != ALLOC_OK)) {
+            pthread_mutex_unlock(&header->lock);
+            return ALLOC_FAIL;
+        }
+        header->num_allocs = 0;
+        header->alloc_size = 0;
+        header->num_gaps = 0;
+        for (uint64_t i = 0; i < header->num_segments; i++) {
+            if (table[i].allocated) {
+                header->num_allocs += 1;
+                header->alloc_size += table[i].size;
+            }
+            else {
+                header->num_gaps += 1;
+            }
+        }
+        pthread_mutex_consistent(&header->lock);
+        status = 0;
+    }
+#endif
+
+    return (status == 0) ? ALLOC_OK : ALLOC_FAIL;
+}
+
+static void _mem_shared_unlock(pool_mgr_pt pool_mgr) {
+    // the local pool metadata follows the shared one
+    pool_mgr->pool.num_allocs = (unsigned) pool_mgr->shared->num_allocs;
+    pool_mgr->pool.alloc_size = (size_t) pool_mgr->shared->alloc_size;
+    pool_mgr->pool.num_gaps = (unsigned) pool_mgr->shared->num_gaps;
+    pthread_mutex_unlock(&pool_mgr->shared->lock);
+}
+#endif
+
+static void _mem_numa_bind(char *mem, size_t size, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    // there is nothing to choose on a single node
+    unsigned nodes = mem_numa_nodes();
+    if (nodes <= 1) {
+        return;
+    }
+    // bind to the one node, or interleave across all of them
+    unsigned long mask[MEM_NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    const unsigned bits = 8 * sizeof(unsigned long);
+    int mode = MEM_NUMA_MPOL_BIND;
+    if (node == MEM_NUMA_INTERLEAVE) {
+        mode = MEM_NUMA_MPOL_INTERLEAVE;
+        for (unsigned u = 0; u < nodes; u++) {
+            mask[u / bits] |= 1UL << (u % bits);
+        }
+    }
+    else if ((node >= 0) && ((unsigned) node < nodes)) {
+        mask[node / bits] |= 1UL << (node % bits);
+    }
+    else {
+        return;
+    }
+    // note: a failure only means the pages land wherever they are first touched
+    syscall(SYS_mbind, mem, size, mode, mask, (unsigned long) MEM_NUMA_MAX_NODES, 0);
+#else
+    (void) mem;
+    (void) size;
+    (void) node;
+#endif
+}
+
+static pool_mgr_pt _mem_open_mgr(char *mem,
+                                 size_t size,
+                                 alloc_policy policy,
+                                 pool_backing backing) {
+    // allocate a new mem pool mgr
+    pool_mgr_pt mgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
+    // check success, on error return null
+    if (mgr == NULL) {
+        return NULL;
+    }
+    // allocate a new node heap
+    node_pt new_heap = (node_pt) calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(node_t));
+    // check success, on error deallocate mgr and return null
+    if (new_heap == NULL) {
+        free(mgr);
+        return NULL;
+    }
+    // allocate a new gap index
+    gap_pt new_ix = (gap_pt) calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
+    // check success, on error deallocate mgr/heap and return null
+    if (new_ix == NULL) {
+        free(new_heap);
+        free(mgr);
+        return NULL;
+    }
+    // assign all the pointers and update meta data:
+    mgr->pool.mem = mem;
+    mgr->pool.total_size = size;
+    mgr->pool.num_allocs = 0;
+    mgr->pool.alloc_size = 0;
+    mgr->pool.num_gaps = 1;
+    mgr->pool.policy = policy;
+    mgr->backing = backing;
+    mgr->zero_top = 0;
+    mgr->numa_node = MEM_NUMA_NONE;
+
+    //   initialize top node of node heap
+    new_heap[0].allocated = 0;
+    new_heap[0].used = 1;
+    new_heap[0].alloc_record.mem = mem;
+    new_heap[0].prev = NULL;
+    new_heap[0].next = NULL;
+    new_heap[0].alloc_record.size = size;
+    //   initialize top node of gap index
+    new_ix[0].size = size;
+    new_ix[0].node = new_heap;
+    //   initialize pool mgr
+    mgr->gap_ix = new_ix;
+    mgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+    mgr->node_heap = new_heap;
+    atomic_init(&mgr->node_chunks[0], new_heap);
+    mgr->num_chunks = 1;
+    mgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
+    mgr->used_nodes = 1;
+    //   link pool mgr to pool store, in a slot of its own
+    mgr->store_ix = atomic_fetch_add(&pool_store_size, 1);
+    pool_slot_pt slot = _mem_pool_store_slot(mgr->store_ix, 1);
+    if (slot == NULL) {
+        free(new_ix);
+        free(new_heap);
+        free(mgr);
+        return NULL;
+    }
+    atomic_store_explicit(slot, mgr, memory_order_release);
+
+    return mgr;
+}
+
+
+static void _mem_close_mgr(pool_mgr_pt pool_mgr) {
+    // free node heap, chunk by chunk
+    for (unsigned chunk = 0; chunk < pool_mgr->num_chunks; chunk++) {
+        free(pool_mgr->node_chunks[chunk]);
+    }
+    // free gap index
+    free(pool_mgr->gap_ix);
+    free(pool_mgr->pending_q);
+    free(pool_mgr->regions);
+    free(pool_mgr->shards);
+#ifdef MEM_HAVE_PTHREADS
+    if (pool_mgr->flags & POOL_LOCK_MUTEX) {
+        pthread_mutex_destroy(&pool_mgr->mutex);
+    }
+#endif
+    // set the mgr's slot in the pool store to null
+    // note: don't decrement pool_store_size, because it only grows
+    // note: a maintenance pass may have read the slot already, so the mgr outlives the pass
+    atomic_store(_mem_pool_store_slot(pool_mgr->store_ix, 0), NULL);
+    _mem_maint_wait(pool_mgr);
+    // free mgr
+    free(pool_mgr);
+}
+
+#ifdef MEM_HAVE_MMAP
+static alloc_status _mem_file_sync(pool_mgr_pt pool_mgr) {
+    pool_file_header_t *header = (pool_file_header_t *) (pool_mgr->pool.mem - MEM_FILE_HEADER_SIZE);
+    // write the segment table after the pool, as offsets
+    pool_file_segment_pt segs =
+            (pool_file_segment_pt) calloc(pool_mgr->used_nodes, sizeof(pool_file_segment_t));
+    if (segs == NULL) {
+        return ALLOC_FAIL;
+    }
+    unsigned num_segs = 0;
+    for (node_pt node = pool_mgr->node_heap; node; node = node->next) {
+        segs[num_segs].offset = (uint64_t) (node->alloc_record.mem - pool_mgr->pool.mem);
+        segs[num_segs].size = node->alloc_record.size;
+        segs[num_segs].allocated = node->allocated;
+        num_segs++;
+    }
+    // the table is rewritten in place, so the header stops pointing at it first
+    // note: a crash from here until the header is written back leaves a pool file
+    //       without segments, which fails to open, rather than one with a torn table
+    header->num_segments = 0;
+    if (msync(header, MEM_FILE_HEADER_SIZE, MS_SYNC) != 0) {
+        free(segs);
+        return ALLOC_FAIL;
+    }
+    size_t table_size = num_segs * sizeof(pool_file_segment_t);
+    ssize_t written = pwrite(pool_mgr->file_fd, segs, table_size,
+                             (off_t) (MEM_FILE_HEADER_SIZE + pool_mgr->pool.total_size));
+    free(segs);
+    if ((written < 0) || ((size_t) written != table_size)) {
+        return ALLOC_FAIL;
+    }
+    // flush the pool contents along with the table
+    if ((msync(pool_mgr->pool.mem, pool_mgr->pool.total_size, MS_SYNC) != 0)
+        || (fsync(pool_mgr->file_fd) != 0)) {
+        return ALLOC_FAIL;
+    }
+    // the header goes last, so it only ever points at a complete table once synced
+    memcpy(header->magic, MEM_FILE_MAGIC, sizeof(header->magic));
+    header->total_size = pool_mgr->pool.total_size;
+    header->policy = pool_mgr->pool.policy;
+    header->zero_top = pool_mgr->zero_top;
+    header->num_segments = num_segs;
+    if (msync(header, MEM_FILE_HEADER_SIZE, MS_SYNC) != 0) {
+        return ALLOC_FAIL;
+    }
+
+    return ALLOC_OK;
+}
+
+static int _mem_file_unsynced(int fd, off_t file_size) {
+    // a pool file that was never synced has a blank header, and a pool after it
+    if (file_size <= (off_t) MEM_FILE_HEADER_SIZE) {
+        return 0;
+    }
+    char block[512];
+    for (size_t offset = 0; offset < MEM_FILE_HEADER_SIZE; offset += sizeof(block)) {
+        if (pread(fd, block, sizeof(block), (off_t) offset) != (ssize_t) sizeof(block)) {
+            return 0;
+        }
+        for (size_t u = 0; u < sizeof(block); u++) {
+            if (block[u] != 0) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+static int _mem_compare_gaps(const void *a, const void *b) {
+    const gap_t *gap_a = (const gap_t *) a;
+    const gap_t *gap_b = (const gap_t *) b;
+    // same order as _mem_sort_gap_ix: by size, then by address
+    if (gap_a->size != gap_b->size) {
+        return (gap_a->size < gap_b->size) ? -1 : 1;
+    }
+    if (gap_a->node->alloc_record.mem != gap_b->node->alloc_record.mem) {
+        return (gap_a->node->alloc_record.mem < gap_b->node->alloc_record.mem) ? -1 : 1;
+    }
+    return 0;
+}
+
+static alloc_status _mem_check_segments(const pool_file_segment_t *segs,
+                                        uint64_t num_segs,
+                                        uint64_t total_size) {
+    // each segment starts where the previous one ends, and the last one ends the pool
+    uint64_t expected = 0;
+    for (uint64_t u = 0; u < num_segs; u++) {
+        if ((segs[u].offset != expected) || (segs[u].size == 0)) {
+            return ALLOC_FAIL;
+        }
+        expected += segs[u].size;
+    }
+
+    return (expected == total_size) ? ALLOC_OK : ALLOC_FAIL;
+}
+
+static alloc_status _mem_file_restore(pool_mgr_pt pool_mgr, const pool_file_header_t *header) {
+    unsigned num_segs = (unsigned) header->num_segments;
+    if (num_segs == 0) {
+        return ALLOC_FAIL;
+    }
+    // read the segment table
+    size_t table_size = num_segs * sizeof(pool_file_segment_t);
+    pool_file_segment_pt segs = (pool_file_segment_pt) malloc(table_size);
+    if (segs == NULL) {
+        return ALLOC_FAIL;
+    }
+    if (pread(pool_mgr->file_fd, segs, table_size,
+              (off_t) (MEM_FILE_HEADER_SIZE + pool_mgr->pool.total_size)) != (ssize_t) table_size) {
+        free(segs);
+        return ALLOC_FAIL;
+    }
+    // the segments have to tile the pool
+    if (_mem_check_segments(segs, num_segs, pool_mgr->pool.total_size) != ALLOC_OK) {
+        free(segs);
+        return ALLOC_FAIL;
+    }
+    // size the node heap and gap index for all the segments at once
+    // note: the pool is fresh, so its only node is the first one, which is rebuilt as well
+    unsigned capacity = MEM_NODE_HEAP_INIT_CAPACITY;
+    while ((float) num_segs / capacity > MEM_NODE_HEAP_FILL_FACTOR) {
+        capacity *= MEM_NODE_HEAP_EXPAND_FACTOR;
+    }
+    if ((_mem_expand_node_heap(pool_mgr, capacity) != ALLOC_OK)
+        || (_mem_expand_gap_ix(pool_mgr, capacity) != ALLOC_OK)) {
+        free(segs);
+        return ALLOC_FAIL;
+    }
+    gap_pt ix = pool_mgr->gap_ix;
+    // rebuild the list, in pool order, and the gap index
+    pool_mgr->pool.num_allocs = 0;
+    pool_mgr->pool.alloc_size = 0;
+    pool_mgr->pool.num_gaps = 0;
+    node_pt prev = NULL;
+    for (unsigned u = 0; u < num_segs; u++) {
+        node_pt node = _mem_node_at(pool_mgr, u);
+        node->used = 1;
+        node->allocated = (unsigned) segs[u].allocated;
+        node->alloc_record.mem = pool_mgr->pool.mem + segs[u].offset;
+        node->alloc_record.size = segs[u].size;
+        node->prev = prev;
+        node->next = NULL;
+        if (prev) {
+            prev->next = node;
+        }
+        prev = node;
+        if (node->allocated) {
+            pool_mgr->pool.num_allocs += 1;
+            pool_mgr->pool.alloc_size += node->alloc_record.size;
+        }
+        else {
+            ix[pool_mgr->pool.num_gaps].size = node->alloc_record.size;
+            ix[pool_mgr->pool.num_gaps].node = node;
+            pool_mgr->pool.num_gaps += 1;
+        }
+    }
+    qsort(ix, pool_mgr->pool.num_gaps, sizeof(gap_t), _mem_compare_gaps);
+    pool_mgr->used_nodes = num_segs;
+    pool_mgr->zero_top = header->zero_top;
+    free(segs);
+
+    return ALLOC_OK;
+}
+#endif
+
+static alloc_status _mem_extend_pool(pool_mgr_pt pool_mgr, size_t min_size) {
+    // remapping keeps the pool in one piece, but only while it is in one piece
+    if ((pool_mgr->flags & POOL_REMAP) && (pool_mgr->num_regions <= 1)
+        && (_mem_remap_pool(pool_mgr, min_size) == ALLOC_OK)) {
+        return ALLOC_OK;
+    }
+    if (pool_mgr->flags & POOL_GROWABLE) {
+        return _mem_grow_pool(pool_mgr, min_size);
+    }
+
+    return ALLOC_FAIL;
+}
 
+static alloc_status _mem_remap_pool(pool_mgr_pt pool_mgr, size_t min_size) {
+#if defined(MEM_HAVE_MMAP) && defined(MREMAP_MAYMOVE)
+    // only a plain anonymous mapping can be resized in place, or moved
+    if (pool_mgr->backing != POOL_BACKING_MMAP) {
+        return ALLOC_FAIL;
+    }
+    // grow geometrically, but at least enough for the request
+    size_t old_size = pool_mgr->pool.total_size;
+    size_t new_size = old_size * MEM_POOL_GROW_FACTOR;
+    if (new_size < old_size + min_size) {
+        new_size = old_size + min_size;
+    }
+    // the tail node is where the new memory goes
+    // note: expand the node heap first, a new gap after the last allocation takes a node
+    _mem_resize_node_heap(pool_mgr);
+    node_pt tail = pool_mgr->node_heap;
+    while (tail->next) {
+        tail = tail->next;
+    }
+    // the kernel moves the page tables, not the contents
+    char *old_mem = pool_mgr->pool.mem;
+    char *new_mem = (char *) mremap(old_mem, old_size, new_size, MREMAP_MAYMOVE);
+    if (new_mem == MAP_FAILED) {
+        return ALLOC_FAIL;
+    }
+    // a locked pool stays locked, the new pages may still have to be faulted in
+    _mem_warm_region(new_mem + old_size, new_size - old_size, pool_mgr->flags & ~POOL_MLOCK);
+    // if the pool moved, every segment moves with it, by offset
+    // note: the allocation records are in the nodes, so the user's alloc->mem follows too
+    if (new_mem != old_mem) {
+        for (unsigned u = 0; u < pool_mgr->total_nodes; u++) {
+            node_pt node = _mem_node_at(pool_mgr, u);
+            if (node->used) {
+                uintptr_t offset = (uintptr_t) node->alloc_record.mem - (uintptr_t) old_mem;
+                node->alloc_record.mem = new_mem + offset;
+            }
+        }
+        pool_mgr->pool.mem = new_mem;
+    }
+    if (pool_mgr->regions) {
+        pool_mgr->regions[0].mem = new_mem;
+        pool_mgr->regions[0].size = new_size;
+    }
+    pool_mgr->pool.total_size = new_size;
+    // the tail gap gets bigger, or a new one follows the tail allocation
+    alloc_status status;
+    if ((tail->allocated == 0) && (tail->pending == 0)) {
+        status = _mem_remove_from_gap_ix(pool_mgr, tail->alloc_record.size, tail);
+        assert(status == ALLOC_OK);
+        tail->alloc_record.size += new_size - old_size;
+        status = _mem_add_to_gap_ix(pool_mgr, tail->alloc_record.size, tail);
+        assert(status == ALLOC_OK);
+    }
+    else {
+        node_pt node = _mem_get_unused_node(pool_mgr);
+        assert(node);
+        node->used = 1;
+        node->allocated = 0;
+        node->pending = 0;
+        node->alloc_record.mem = new_mem + old_size;
+        node->alloc_record.size = new_size - old_size;
+        node->prev = tail;
+        node->next = NULL;
+        tail->next = node;
+        pool_mgr->used_nodes += 1;
+        status = _mem_add_to_gap_ix(pool_mgr, node->alloc_record.size, node);
+        assert(status == ALLOC_OK);
+    }
+
+    return ALLOC_OK;
+#else
+    (void) pool_mgr;
+    (void) min_size;
+    return ALLOC_FAIL;
+#endif
+}
+
+static alloc_status _mem_grow_pool(pool_mgr_pt pool_mgr, size_t min_size) {
+    // grow geometrically, but at least enough for the request
+    size_t size = pool_mgr->regions[pool_mgr->num_regions - 1].size * MEM_POOL_GROW_FACTOR;
+    if (size < min_size) {
+        size = min_size;
+    }
+    if (pool_mgr->flags & POOL_HUGE_PAGES) {
+        size = ((size + MEM_HUGE_PAGE_SIZE - 1) / MEM_HUGE_PAGE_SIZE) * MEM_HUGE_PAGE_SIZE;
+    }
+    // expand the region table, if necessary
+    if (pool_mgr->num_regions == pool_mgr->regions_capacity) {
+        region_pt resize = (region_pt) realloc(pool_mgr->regions,
+                                               pool_mgr->regions_capacity * MEM_REGIONS_EXPAND_FACTOR * sizeof(region_t));
+        if (resize == NULL) {
+            return ALLOC_FAIL;
+        }
+        pool_mgr->regions = resize;
+        pool_mgr->regions_capacity *= MEM_REGIONS_EXPAND_FACTOR;
+    }
+    // get a node for the new gap, expanding the node heap if necessary
+    _mem_resize_node_heap(pool_mgr);
+    node_pt node = _mem_get_unused_node(pool_mgr);
+    assert(node);
+    // map the new region, on the same node as the rest of the pool, and only then warm it
+    pool_backing backing;
+    unsigned map_flags = pool_mgr->flags;
+    if (pool_mgr->numa_node != MEM_NUMA_NONE) {
+        map_flags &= ~POOL_PREFAULT;
+    }
+    char *mem = _mem_map_region(size, map_flags, &backing);
+    if (mem == NULL) {
+        return ALLOC_FAIL;
+    }
+    if (pool_mgr->numa_node != MEM_NUMA_NONE) {
+        _mem_numa_bind(mem, size, pool_mgr->numa_node);
+    }
+    if (_mem_warm_region(mem, size, pool_mgr->flags) != ALLOC_OK) {
+        _mem_unmap_region(mem, size, backing);
+        return ALLOC_FAIL;
+    }
+    region_pt region = &pool_mgr->regions[pool_mgr->num_regions];
+    region->mem = mem;
+    region->size = size;
+    region->backing = backing;
+    region->zero_top = 0;
+    pool_mgr->num_regions += 1;
+    // the whole region is a gap at the end of the list
+    node_pt tail = pool_mgr->node_heap;
+    while (tail->next) {
+        tail = tail->next;
+    }
+    node->used = 1;
+    node->allocated = 0;
+    node->pending = 0;
+    node->alloc_record.mem = mem;
+    node->alloc_record.size = size;
+    node->prev = tail;
+    node->next = NULL;
+    tail->next = node;
+    pool_mgr->used_nodes += 1;
+    pool_mgr->pool.total_size += size;
+    alloc_status status = _mem_add_to_gap_ix(pool_mgr, size, node);
+    assert(status == ALLOC_OK);
+
+    return ALLOC_OK;
+}
+
+// note: returns NULL for the first region, whose bookkeeping is in the pool mgr itself
+static region_pt _mem_find_region(pool_mgr_pt pool_mgr, char *mem) {
+    for (unsigned u = 1; u < pool_mgr->num_regions; u++) {
+        region_pt region = &pool_mgr->regions[u];
+        if ((mem >= region->mem) && (mem < region->mem + region->size)) {
+            return region;
+        }
+    }
+
+    return NULL;
+}
@@ -6,11 +6,38 @@
 #define DENVER_OS_PA_C_MEM_POOL_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#define MEM_SHARED_NULL UINT64_MAX // no allocation in a shared pool
+#define MEM_NUMA_INTERLEAVE (-1) // spread a pool across all NUMA nodes
 
 /* type declarations */
 
 typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
 
+typedef enum _pool_flags {
+    POOL_DEFAULT    = 0,
+    POOL_MMAP       = 1 << 0, // back the pool with an anonymous mapping instead of calloc()
+    POOL_HUGE_PAGES = 1 << 1, // back the pool with 2 MiB pages, rounding the size up
+    POOL_GROWABLE   = 1 << 2, // add regions when the pool runs out instead of failing
+    POOL_PREFAULT   = 1 << 3, // fault in the whole pool on open
+    POOL_MLOCK      = 1 << 4, // lock the pool in memory on open, implies POOL_MMAP
+    POOL_REMAP      = 1 << 5, // grow the pool in place with mremap(), implies POOL_MMAP, not with a lock
+    POOL_LOCK_SPIN  = 1 << 6, // guard the pool with a spinlock, for use by several threads
+    POOL_LOCK_MUTEX = 1 << 7, // guard the pool with a mutex, for use by several threads
+    POOL_THREAD_CACHE = 1 << 8 // keep freed blocks in per-thread caches, per size
+} pool_flags;
+
+typedef enum _pool_backing {
+    POOL_BACKING_HEAP,
+    POOL_BACKING_MMAP,
+    POOL_BACKING_HUGETLB, // reserved huge pages (MAP_HUGETLB)
+    POOL_BACKING_THP,     // transparent huge pages (MADV_HUGEPAGE)
+    POOL_BACKING_FILE,    // shared mapping of a persistent pool file
+    POOL_BACKING_EXTERNAL, // buffer provided by the caller
+    POOL_BACKING_SHARED   // shared memory object, with the metadata in it
+} pool_backing;
+
 typedef struct _pool {
     char *mem;
     alloc_policy policy;
@@ -30,6 +57,8 @@ typedef struct _pool_segment {
     unsigned long allocated; // 1-allocation, 0-gap (note: 8 bytes)
 } pool_segment_t, *pool_segment_pt;
 
+typedef struct _slab *slab_pt; // fixed-size objects, allocated and freed without a lock
+
 typedef enum _alloc_status {
     ALLOC_OK,
     ALLOC_FAIL,
@@ -42,22 +71,119 @@ typedef enum _alloc_status {
 alloc_status
 mem_init();
 
+alloc_status
+mem_init_ex(unsigned maintenance_ms);
+
 alloc_status
 mem_free();
 
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+pool_pt
+mem_pool_open_ex(size_t size, alloc_policy policy, unsigned flags);
+
+pool_pt
+mem_pool_open_numa(size_t size, alloc_policy policy, unsigned flags, int node);
+
+alloc_status
+mem_pool_open_per_node(size_t size,
+                       alloc_policy policy,
+                       unsigned flags,
+                       pool_pt *pools[],
+                       unsigned *num_pools);
+
+unsigned
+mem_numa_nodes();
+
+pool_pt
+mem_pool_open_external(char *mem, size_t size, alloc_policy policy);
+
+pool_pt
+mem_pool_open_sharded(size_t size, alloc_policy policy, unsigned num_shards);
+
+pool_pt
+mem_pool_open_striped(size_t size, alloc_policy policy, unsigned num_stripes);
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
+pool_backing
+mem_pool_backing(pool_pt pool);
+
+alloc_status
+mem_pool_shrink(pool_pt pool);
+
+pool_pt
+mem_pool_open_file(const char *path, size_t size, alloc_policy policy);
+
+alloc_status
+mem_pool_sync(pool_pt pool);
+
+size_t
+mem_alloc_offset(pool_pt pool, alloc_pt alloc);
+
+alloc_pt
+mem_alloc_at(pool_pt pool, size_t offset);
+
+pool_pt
+mem_pool_open_shared(const char *name, size_t size, alloc_policy policy);
+
+alloc_status
+mem_pool_unlink_shared(const char *name);
+
+uint64_t
+mem_shared_alloc(pool_pt pool, size_t size);
+
+alloc_status
+mem_shared_free(pool_pt pool, uint64_t offset);
+
 alloc_pt
 mem_new_alloc(pool_pt pool, size_t size);
 
+alloc_pt
+mem_new_alloc_aligned(pool_pt pool, size_t size, size_t alignment);
+
+alloc_pt
+mem_new_alloc_near(pool_pt pool, size_t size, alloc_pt hint_alloc);
+
+alloc_pt
+mem_new_alloc_zeroed(pool_pt pool, size_t size);
+
 alloc_status
 mem_del_alloc(pool_pt pool, alloc_pt alloc);
 
+alloc_status
+mem_thread_cache_flush(pool_pt pool);
+
+alloc_status
+mem_pool_set_deferred_free(pool_pt pool, unsigned threshold);
+
+alloc_status
+mem_pool_set_size_classes(pool_pt pool, size_t quantum, size_t small_max, unsigned steps_per_doubling);
+
+alloc_status
+mem_pool_reserve(pool_pt pool, unsigned max_segments);
+
+alloc_status
+mem_pool_set_trim_threshold(pool_pt pool, size_t threshold);
+
+slab_pt
+mem_slab_open(pool_pt pool, size_t object_size, unsigned num_objects);
+
+alloc_status
+mem_slab_close(slab_pt slab);
+
+void *
+mem_slab_alloc(slab_pt slab);
+
+alloc_status
+mem_slab_free(slab_pt slab, void *object);
+
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
+alloc_status
+mem_inspect_pool_snapshot(pool_pt pool, pool_t *stats, pool_segment_pt *segments, unsigned *num_segments);
+
 #endif //DENVER_OS_PA_C_MEM_POOL_H
@@ -0,0 +1,142 @@
+//
+// Multi-threaded benchmark of the lock-free slab against a locked pool.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mem_pool.h"
+
+
+/*****             parameters          *****/
+
+#define OBJECT_SIZE     64
+#define OBJECTS         (64 * 1024)
+#define BATCH           32
+#define OPS_PER_THREAD  (1000 * 1000)
+#define MAX_THREADS     64
+
+
+/*****             workers             *****/
+
+typedef struct _worker {
+    pthread_t thread;
+    slab_pt slab; // NULL to use the pool
+    pool_pt pool;
+    unsigned long ops;
+} worker_t, *worker_pt;
+
+static void *slab_worker(void *arg) {
+    worker_pt worker = (worker_pt) arg;
+    void *objects[BATCH];
+
+    // allocate and free in small batches, as a request loop would
+    while (worker->ops < OPS_PER_THREAD) {
+        unsigned n = 0;
+        while (n < BATCH) {
+            objects[n] = mem_slab_alloc(worker->slab);
+            if (objects[n] == NULL) {
+                break;
+            }
+            memset(objects[n], (int) n, OBJECT_SIZE);
+            n++;
+        }
+        for (unsigned u = 0; u < n; u++) {
+            mem_slab_free(worker->slab, objects[u]);
+        }
+        worker->ops += 2 * n;
+    }
+
+    return NULL;
+}
+
+static void *pool_worker(void *arg) {
+    worker_pt worker = (worker_pt) arg;
+    alloc_pt allocs[BATCH];
+
+    while (worker->ops < OPS_PER_THREAD) {
+        unsigned n = 0;
+        while (n < BATCH) {
+            allocs[n] = mem_new_alloc(worker->pool, OBJECT_SIZE);
+            if (allocs[n] == NULL) {
+                break;
+            }
+            memset(allocs[n]->mem, (int) n, OBJECT_SIZE);
+            n++;
+        }
+        for (unsigned u = 0; u < n; u++) {
+            mem_del_alloc(worker->pool, allocs[u]);
+        }
+        worker->ops += 2 * n;
+    }
+
+    return NULL;
+}
+
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static double run(unsigned num_threads, slab_pt slab, pool_pt pool) {
+    worker_t workers[MAX_THREADS];
+
+    memset(workers, 0, sizeof(workers));
+    double start = now();
+    for (unsigned u = 0; u < num_threads; u++) {
+        workers[u].slab = slab;
+        workers[u].pool = pool;
+        pthread_create(&workers[u].thread, NULL, (slab) ? slab_worker : pool_worker, &workers[u]);
+    }
+    unsigned long ops = 0;
+    for (unsigned u = 0; u < num_threads; u++) {
+        pthread_join(workers[u].thread, NULL);
+        ops += workers[u].ops;
+    }
+
+    return (double) ops / (now() - start);
+}
+
+
+/*****             main                *****/
+
+int main(int argc, char *argv[]) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned max_threads = (argc > 1) ? (unsigned) atoi(argv[1]) : (unsigned) cores;
+
+    if ((max_threads == 0) || (max_threads > MAX_THREADS)) {
+        max_threads = MAX_THREADS;
+    }
+    mem_init();
+
+    pool_pt slab_pool = mem_pool_open_ex(OBJECT_SIZE * OBJECTS + 4096, FIRST_FIT, POOL_MMAP);
+    slab_pt slab = mem_slab_open(slab_pool, OBJECT_SIZE, OBJECTS);
+    pool_pt locked_pool = mem_pool_open_ex(OBJECT_SIZE * OBJECTS, FIRST_FIT, POOL_MMAP | POOL_LOCK_MUTEX);
+    if ((slab == NULL) || (locked_pool == NULL)) {
+        fprintf(stderr, "slab_bench: cannot open the pools\n");
+        return 1;
+    }
+    // every thread can hold a full batch, so the node heap does not grow while timed
+    mem_pool_reserve(locked_pool, 2 * MAX_THREADS * BATCH + 1);
+
+    printf("%8s %16s %16s\n", "threads", "slab Mops/s", "mutex Mops/s");
+    for (unsigned num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        double slab_rate = run(num_threads, slab, NULL);
+        double pool_rate = run(num_threads, NULL, locked_pool);
+        printf("%8u %16.2f %16.2f\n", num_threads, slab_rate / 1e6, pool_rate / 1e6);
+    }
+
+    mem_slab_close(slab);
+    mem_pool_close(slab_pool);
+    mem_pool_close(locked_pool);
+    mem_free();
+
+    return 0;
+}
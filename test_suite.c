@@ -4,6 +4,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -85,10 +92,12 @@ static void check_metadata(pool_pt pool,
                     unsigned num_gaps) {
     pool_segment_pt segs = NULL;
     unsigned size = 0;
+    pool_t stats;
 
     assert_non_null(pool);
 
-    mem_inspect_pool(pool, &segs, &size);
+    // the counters of a sharded pool are only added up in a snapshot
+    assert_int_equal(mem_inspect_pool_snapshot(pool, &stats, &segs, &size), ALLOC_OK);
 
     assert_non_null(segs);
     assert_int_not_equal(size, 0);
@@ -99,9 +108,9 @@ static void check_metadata(pool_pt pool,
 
     printf("%10s = %lu(%lu),\n%10s = %lu(%lu),\n%10s = %u(%u),\n%10s = %u(%u)\n",
            (char *) "total_size", pool->total_size, total_size,
-           (char *) "alloc_size", pool->alloc_size, alloc_size,
-           (char *) "num_allocs", pool->num_allocs, num_allocs,
-           (char *) "num_gaps",   pool->num_gaps,   num_gaps);
+           (char *) "alloc_size", stats.alloc_size, alloc_size,
+           (char *) "num_allocs", stats.num_allocs, num_allocs,
+           (char *) "num_gaps",   stats.num_gaps,   num_gaps);
 #endif
 
     if (segs) free(segs);
@@ -110,9 +119,9 @@ static void check_metadata(pool_pt pool,
     assert_non_null(pool->mem);
     assert_int_equal(pool->policy, policy);
     assert_in_range(pool->total_size, total_size, total_size);
-    assert_in_range(pool->alloc_size, alloc_size, alloc_size);
-    assert_true(pool->num_allocs == num_allocs);
-    assert_true(pool->num_gaps == num_gaps);
+    assert_in_range(stats.alloc_size, alloc_size, alloc_size);
+    assert_true(stats.num_allocs == num_allocs);
+    assert_true(stats.num_gaps == num_gaps);
 
 #ifdef INSPECT_POOL
     printf("\n\n");
@@ -2317,9 +2326,6 @@ static void test_pool_scenario19(void **state) {
 
 /*******************************************/
 /***          5. STRESS TEST             ***/
-/***                                     ***/
-/***         [non-functional]            ***/
-/***         [see NOTE below]            ***/
 /*******************************************/
 
 void test_pool_stresstest(void **state) {
@@ -2338,14 +2344,10 @@ void test_pool_stresstest(void **state) {
     alloc_pt allocations[num_pools][num_allocations];
 
     /*
-     * NOTE: This will work iff the address of the allocation
-     * in the pool is returned to the user instead of the
-     * address of the allocation record. Since allocation records
-     * are a part of the nodes, when the node heap is reallocated
-     * the node addresses shift with it, and so do the allocation
-     * record addresses. The allocation addresses on the pool
-     * remain the same, however, so they can be returned to the
-     * user and gotten from the user upon request for deletion.
+     * NOTE: This works because the node heap grows by adding
+     * chunks, so the nodes, and the allocation records that
+     * are a part of them, never move. The allocation record
+     * addresses held here stay valid as the heap grows.
      */
 
     /*
@@ -2408,7 +2410,1615 @@ void test_pool_stresstest(void **state) {
 
 
 /*******************************************/
-/***         6. DRIVER ROUTINE           ***/
+/***        6. EXTENDED API TESTS        ***/
+/*******************************************/
+
+static void test_pool_aligned_alloc(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Aligned allocation:
+     *
+     * 1. Allocate 100 to knock the top of the gap off any alignment.
+     * 2. Allocate 64 aligned to a cache line. The padding becomes a gap.
+     * 3. Allocate 4096 aligned to a page.
+     * 4. Deallocate all. Pool is again one single gap.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+
+    assert_null(mem_new_alloc_aligned(pool, 64, 0));
+    assert_null(mem_new_alloc_aligned(pool, 64, 48));
+
+    size_t pad1 = (64 - ((uintptr_t) (pool->mem + 100) % 64)) % 64;
+    alloc_pt alloc1 = mem_new_alloc_aligned(pool, 64, 64);
+    assert_non_null(alloc1);
+    assert_int_equal((uintptr_t) alloc1->mem % 64, 0);
+    assert_true(alloc1->mem == pool->mem + 100 + pad1);
+    assert_int_equal(alloc1->size, 64);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 164, 2, (pad1 > 0) ? 2 : 1);
+
+    alloc_pt alloc2 = mem_new_alloc_aligned(pool, 4096, 4096);
+    assert_non_null(alloc2);
+    assert_int_equal((uintptr_t) alloc2->mem % 4096, 0);
+    assert_int_equal(alloc2->size, 4096);
+    print_pool(pool);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_zeroed_alloc(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Zeroed allocation:
+     *
+     * 1. Allocate 100 and dirty it. Deallocate it.
+     * 2. Allocate 300 zeroed. The dirty 100 at the top are cleared.
+     * 3. Allocate 1000 zeroed from memory never handed out.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    memset(alloc0->mem, 0xff, alloc0->size);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+    alloc_pt alloc1 = mem_new_alloc_zeroed(pool, 300);
+    assert_non_null(alloc1);
+    for (unsigned u = 0; u < alloc1->size; u ++)
+        assert_int_equal(alloc1->mem[u], 0);
+    memset(alloc1->mem, 0xff, alloc1->size);
+
+    alloc_pt alloc2 = mem_new_alloc_zeroed(pool, 1000);
+    assert_non_null(alloc2);
+    for (unsigned u = 0; u < alloc2->size; u ++)
+        assert_int_equal(alloc2->mem[u], 0);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_deferred_free(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Deferred free:
+     *
+     * 1. Queue up to 3 frees.
+     * 2. Allocate 100, 200, 300, 400. Free 200 and 300: they are queued, not merged.
+     * 3. Allocate 200. The queued 200 is handed back in place.
+     * 4. Allocate 500. No queued fit, so it comes off the tail gap.
+     * 5. Free 100, 200, 400. The full queue is merged in bulk before 400 is queued.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+
+    assert_int_equal(mem_pool_set_deferred_free(pool, 3), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    alloc_pt alloc3 = mem_new_alloc(pool, 400);
+    assert_non_null(alloc3);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    pool_segment_t exp1[5] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {300, 0},
+                    {400, 1},
+                    {pool->total_size - 1000, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 500, 2, 1);
+
+    alloc_pt alloc4 = mem_new_alloc(pool, 200);
+    assert_true(alloc4 == alloc1);
+    alloc_pt alloc5 = mem_new_alloc(pool, 500);
+    assert_true(alloc5->mem == pool->mem + 1000);
+
+    pool_segment_t exp2[6] =
+            {
+                    {100, 1},
+                    {200, 1},
+                    {300, 0},
+                    {400, 1},
+                    {500, 1},
+                    {pool->total_size - 1500, 0}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 1200, 4, 1);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    pool_segment_t exp3[4] =
+            {
+                    {600, 0},
+                    {400, 0},
+                    {500, 1},
+                    {pool->total_size - 1500, 0}
+            };
+    check_pool(pool, exp3);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 500, 1, 2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    assert_int_equal(mem_pool_set_deferred_free(pool, 0), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_size_classes(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Size classes:
+     *
+     * 1. Round to 16 up to 256, then 4 classes per doubling.
+     * 2. Allocate 1, 100, 300, 1001. They come out as 16, 112, 320, 1024.
+     * 3. Free 1024 and allocate 1000. It fills the freed gap exactly.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+
+    assert_int_equal(mem_pool_set_size_classes(pool, 16, 256, 0), ALLOC_FAIL);
+    assert_int_equal(mem_pool_set_size_classes(pool, 16, 256, 4), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 1);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    alloc_pt alloc2 = mem_new_alloc(pool, 1001);
+    alloc_pt alloc3 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc3);
+    assert_int_equal(alloc0->size, 16);
+    assert_int_equal(alloc1->size, 112);
+    assert_int_equal(alloc2->size, 1024);
+    assert_int_equal(alloc3->size, 320);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 1472, 4, 1);
+
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    alloc2 = mem_new_alloc(pool, 1000);
+    assert_int_equal(alloc2->size, 1024);
+
+    pool_segment_t exp1[5] =
+            {
+                    {16, 1},
+                    {112, 1},
+                    {1024, 1},
+                    {320, 1},
+                    {pool->total_size - 1472, 0}
+            };
+    check_pool(pool, exp1);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_near_alloc(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Allocation near a hint:
+     *
+     * 1. Allocate 100, 200, 300, 400, 500, 600. Free 100, 300, 500.
+     * 2. Allocate 80 near 200. Both neighbors are gaps; the one after wins.
+     * 3. Allocate 90 near 200. The 100 gap before is adjacent, so carve from its end.
+     * 4. Allocate 450 near 400. Comes from the start of the 500 gap after it.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+
+    alloc_pt allocs[6];
+    for (int i = 0; i < 6; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100 * (i + 1));
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc_near(pool, 80, allocs[1]);
+    assert_non_null(alloc0);
+    assert_true(alloc0->mem == allocs[1]->mem + 200);
+
+    alloc_pt alloc1 = mem_new_alloc_near(pool, 90, allocs[1]);
+    assert_non_null(alloc1);
+    assert_true(alloc1->mem + 90 == allocs[1]->mem);
+
+    alloc_pt alloc2 = mem_new_alloc_near(pool, 450, allocs[3]);
+    assert_non_null(alloc2);
+    assert_true(alloc2->mem == allocs[3]->mem + 400);
+
+    pool_segment_t exp1[10] =
+            {
+                    {10, 0},
+                    {90, 1},
+                    {200, 1},
+                    {80, 1},
+                    {220, 0},
+                    {400, 1},
+                    {450, 1},
+                    {50, 0},
+                    {600, 1},
+                    {pool->total_size - 2100, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 1820, 6, 4);
+
+    // a hint that is not one of the pool's records is ignored, not followed
+    alloc_t stray = {200, allocs[1]->mem};
+    alloc_pt alloc3 = mem_new_alloc_near(pool, 40, &stray);
+    assert_non_null(alloc3);
+    assert_true(alloc3->mem == allocs[3]->mem + 850);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    check_pool(pool, exp1);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_mmap_backing(void **state) {
+    (void) state; /* unused */
+
+    const size_t pool_size = (size_t) 1 << 30;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_ex(POOL_SIZE, BEST_FIT, POOL_DEFAULT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_backing(pool), POOL_BACKING_HEAP);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes backed by mmap\n", (unsigned long) pool_size);
+    pool = mem_pool_open_ex(pool_size, FIRST_FIT, POOL_MMAP);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_backing(pool), POOL_BACKING_MMAP);
+    assert_true(pool->total_size == pool_size);
+
+    alloc_pt alloc0 = mem_new_alloc_zeroed(pool, 100);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->mem[99], 0);
+    alloc_pt alloc1 = mem_new_alloc(pool, pool_size - 100);
+    assert_non_null(alloc1);
+    alloc1->mem[alloc1->size - 1] = 1;
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_huge_pages(void **state) {
+    (void) state; /* unused */
+
+    const size_t huge_page = 2 * 1024 * 1024;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_ex(3 * huge_page + 1, BEST_FIT, POOL_HUGE_PAGES);
+    assert_non_null(pool);
+    INFO("Huge page pool backing is %d\n", (int) mem_pool_backing(pool));
+    assert_true(pool->total_size == 4 * huge_page);
+    assert_int_equal((uintptr_t) pool->mem % huge_page, 0);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, huge_page);
+    assert_non_null(alloc1);
+    if (mem_pool_backing(pool) != POOL_BACKING_MMAP) {
+        assert_true(alloc1->mem == pool->mem + huge_page);
+    }
+    alloc_pt alloc2 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_trim_gaps(void **state) {
+    (void) state; /* unused */
+
+    const size_t big_size = 8 * 1024 * 1024;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_ex(POOL_SIZE, BEST_FIT, POOL_DEFAULT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_trim_threshold(pool, 1024 * 1024), ALLOC_FAIL);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    pool = mem_pool_open_ex(4 * big_size, FIRST_FIT, POOL_MMAP);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_trim_threshold(pool, 1024 * 1024), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, big_size);
+    alloc_pt alloc2 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc2);
+    memset(alloc1->mem, 0xff, alloc1->size);
+
+    // the freed pages are released, so they read back as zero
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    alloc1 = mem_new_alloc(pool, big_size);
+    assert_non_null(alloc1);
+    assert_int_equal(alloc1->mem[big_size / 2], 0);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_file_backed(void **state) {
+    (void) state; /* unused */
+
+    const char *path = "test_pool_file.bin";
+
+    remove(path);
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    /*
+     * Persistent pool:
+     *
+     * 1. Open a new pool file. Allocate 100, 200, 300, free 200, fill in the others.
+     * 2. Close the pool with its allocations in it.
+     * 3. Reopen the file. The segments and the contents are back.
+     */
+
+    pool_pt pool = mem_pool_open_file(path, POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_backing(pool), POOL_BACKING_FILE);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    memset(alloc0->mem, 'a', alloc0->size);
+    memset(alloc2->mem, 'c', alloc2->size);
+    size_t offset2 = mem_alloc_offset(pool, alloc2);
+    assert_int_equal(offset2, 300);
+    assert_int_equal(mem_pool_sync(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    pool = mem_pool_open_file(path, 0, FIRST_FIT);
+    assert_non_null(pool);
+
+    pool_segment_t exp[4] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {300, 1},
+                    {POOL_SIZE - 600, 0}
+            };
+    check_pool(pool, exp);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 400, 2, 2);
+
+    alloc0 = mem_alloc_at(pool, 0);
+    alloc2 = mem_alloc_at(pool, offset2);
+    assert_non_null(alloc0);
+    assert_non_null(alloc2);
+    assert_null(mem_alloc_at(pool, 100));
+    assert_int_equal(alloc0->mem[99], 'a');
+    assert_int_equal(alloc2->mem[0], 'c');
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    remove(path);
+
+    // a pool file that was never synced has a blank header, but its pool may hold anything
+    char filler[1000];
+    memset(filler, 0xff, sizeof(filler));
+    FILE *file = fopen(path, "wb");
+    assert_non_null(file);
+    for (unsigned u = 0; u < 4096; u++) {
+        fputc(0, file);
+    }
+    assert_int_equal(fwrite(filler, 1, sizeof(filler), file), sizeof(filler));
+    fclose(file);
+    pool = mem_pool_open_file(path, 0, FIRST_FIT);
+    assert_non_null(pool);
+    check_metadata(pool, FIRST_FIT, 1000, 0, 0, 1);
+    alloc0 = mem_new_alloc_zeroed(pool, 1000);
+    assert_non_null(alloc0);
+    for (unsigned u = 0; u < 1000; u++) {
+        assert_int_equal(alloc0->mem[u], 0);
+    }
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    remove(path);
+
+    // any other file is left alone
+    file = fopen(path, "wb");
+    assert_non_null(file);
+    fputs("not a pool", file);
+    fclose(file);
+    assert_null(mem_pool_open_file(path, POOL_SIZE, FIRST_FIT));
+    file = fopen(path, "rb");
+    assert_non_null(file);
+    assert_int_equal(fgetc(file), 'n');
+    fclose(file);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+    remove(path);
+}
+
+static void test_pool_growable(void **state) {
+    (void) state; /* unused */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    /*
+     * Growable pool:
+     *
+     * 1. Open a pool of 1000. Allocate 600, 300.
+     * 2. Allocate 500. It does not fit, so a region of 2000 is added.
+     * 3. Free 500. The new region does not merge with the gap before it.
+     * 4. Shrink. The free region is released.
+     */
+
+    pool_pt pool = mem_pool_open_ex(1000, FIRST_FIT, POOL_GROWABLE);
+    assert_non_null(pool);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 600);
+    alloc_pt alloc1 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc_zeroed(pool, 500);
+    assert_non_null(alloc2);
+    assert_int_equal(alloc2->mem[499], 0);
+
+    pool_segment_t exp0[5] =
+            {
+                    {600, 1},
+                    {300, 1},
+                    {100, 0},
+                    {500, 1},
+                    {1500, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, 3000, 1400, 3, 2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    pool_segment_t exp1[4] =
+            {
+                    {600, 1},
+                    {300, 1},
+                    {100, 0},
+                    {2000, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, 3000, 900, 2, 2);
+
+    assert_int_equal(mem_pool_shrink(pool), ALLOC_OK);
+
+    pool_segment_t exp2[3] =
+            {
+                    {600, 1},
+                    {300, 1},
+                    {100, 0}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, 1000, 900, 2, 1);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_external(void **state) {
+    (void) state; /* unused */
+
+    static char buffer[1000];
+
+    memset(buffer, 0xab, sizeof(buffer));
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_external(buffer, sizeof(buffer), FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_backing(pool), POOL_BACKING_EXTERNAL);
+    assert_true(pool->mem == buffer);
+    assert_int_equal(mem_pool_set_trim_threshold(pool, 100), ALLOC_FAIL);
+
+    alloc_pt alloc0 = mem_new_alloc_zeroed(pool, 100);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->mem[99], 0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    assert_true(alloc1->mem == buffer + 100);
+    assert_int_equal((unsigned char) alloc1->mem[0], 0xab);
+
+    pool_segment_t exp[3] =
+            {
+                    {100, 1},
+                    {200, 1},
+                    {700, 0}
+            };
+    check_pool(pool, exp);
+    check_metadata(pool, FIRST_FIT, 1000, 300, 2, 1);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // the buffer is left as it was
+    assert_int_equal((unsigned char) buffer[999], 0xab);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_shared(void **state) {
+    (void) state; /* unused */
+
+    char name[64];
+
+    snprintf(name, sizeof(name), "/test_pool_shared_%d", (int) getpid());
+    mem_pool_unlink_shared(name);
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    /*
+     * Shared pool:
+     *
+     * 1. Create a shared pool of 1000. Allocate 100 and write to it.
+     * 2. A child process attaches, reads the 100 by its offset, allocates 200, and writes to it.
+     * 3. The parent sees the child's allocation and its contents.
+     */
+
+    pool_pt pool = mem_pool_open_shared(name, 1000, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_backing(pool), POOL_BACKING_SHARED);
+    assert_null(mem_new_alloc(pool, 100));
+
+    uint64_t offset0 = mem_shared_alloc(pool, 100);
+    assert_true(offset0 == 0);
+    strcpy(pool->mem + offset0, "parent");
+
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        pool_pt child_pool = mem_pool_open_shared(name, 0, BEST_FIT);
+        int ok = (child_pool != NULL) && (strcmp(child_pool->mem + offset0, "parent") == 0);
+        uint64_t offset1 = ok ? mem_shared_alloc(child_pool, 200) : MEM_SHARED_NULL;
+        ok = ok && (offset1 == 100);
+        if (ok) {
+            strcpy(child_pool->mem + offset1, "child");
+        }
+        _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    assert_true(waitpid(pid, &status, 0) == pid);
+    assert_true(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+    pool_segment_t exp[3] =
+            {
+                    {100, 1},
+                    {200, 1},
+                    {700, 0}
+            };
+    check_pool(pool, exp);
+    check_metadata(pool, FIRST_FIT, 1000, 300, 2, 1);
+    assert_string_equal(pool->mem + 100, "child");
+
+    assert_int_equal(mem_shared_free(pool, 100), ALLOC_OK);
+    assert_int_equal(mem_shared_free(pool, 100), ALLOC_FAIL);
+    assert_int_equal(mem_shared_free(pool, offset0), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, 1000, 0, 0, 1);
+
+    // a child killed at any point, maybe holding the lock, leaves the table whole,
+    // or the pool failing, but never a torn table
+    pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        pool_pt child_pool = mem_pool_open_shared(name, 0, BEST_FIT);
+        for (unsigned round = 0; child_pool != NULL; round++) {
+            uint64_t offset = mem_shared_alloc(child_pool, 10 + round % 50);
+            if ((offset != MEM_SHARED_NULL) && (round % 3 != 0)) {
+                mem_shared_free(child_pool, offset);
+            }
+        }
+        _exit(1);
+    }
+    usleep(20000);
+    assert_int_equal(kill(pid, SIGKILL), 0);
+    assert_true(waitpid(pid, &status, 0) == pid);
+    uint64_t offset2 = mem_shared_alloc(pool, 10);
+    if (offset2 != MEM_SHARED_NULL) {
+        pool_segment_pt segs = NULL;
+        unsigned num_segs = 0;
+        mem_inspect_pool(pool, &segs, &num_segs);
+        size_t total = 0;
+        size_t allocated = 0;
+        unsigned allocs = 0;
+        for (unsigned u = 0; u < num_segs; u++) {
+            total += segs[u].size;
+            allocated += segs[u].allocated ? segs[u].size : 0;
+            allocs += segs[u].allocated ? 1 : 0;
+        }
+        free(segs);
+        assert_int_equal(total, 1000);
+        assert_int_equal(allocated, pool->alloc_size);
+        assert_int_equal(allocs, pool->num_allocs);
+        assert_int_equal(mem_shared_free(pool, offset2), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_unlink_shared(name), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_numa(void **state) {
+    (void) state; /* unused */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    unsigned nodes = mem_numa_nodes();
+    INFO("NUMA nodes: %u\n", nodes);
+    assert_true(nodes >= 1);
+
+    pool_pt pool = mem_pool_open_numa(POOL_SIZE, BEST_FIT, POOL_DEFAULT, MEM_NUMA_INTERLEAVE);
+    assert_non_null(pool);
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    memset(alloc0->mem, 1, alloc0->size);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // a prefaulted, growable pool is bound first, and faulted in after, region by region
+    pool = mem_pool_open_numa(4096, FIRST_FIT, POOL_PREFAULT | POOL_GROWABLE, 0);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_backing(pool), POOL_BACKING_MMAP);
+    alloc0 = mem_new_alloc(pool, 2 * 4096);
+    assert_non_null(alloc0);
+    memset(alloc0->mem, 1, alloc0->size);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    pool_pt *pools = NULL;
+    unsigned num_pools = 0;
+    assert_int_equal(mem_pool_open_per_node(POOL_SIZE, FIRST_FIT, POOL_DEFAULT, &pools, &num_pools), ALLOC_OK);
+    assert_int_equal(num_pools, nodes);
+    for (unsigned u = 0; u < num_pools; u++) {
+        alloc_pt alloc = mem_new_alloc(pools[u], 100);
+        assert_non_null(alloc);
+        memset(alloc->mem, 1, alloc->size);
+        assert_int_equal(mem_del_alloc(pools[u], alloc), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pools[u]), ALLOC_OK);
+    }
+    free(pools);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_prefault_reserve(void **state) {
+    (void) state; /* unused */
+
+    const unsigned num_allocs = 200;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    /*
+     * Growing the metadata:
+     *
+     * 1. Allocate 200 x 10 in a plain pool. The node heap and the gap index grow on the way.
+     * 2. Free every other one by offset, then the rest.
+     */
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    for (unsigned u = 0; u < num_allocs; u++) {
+        assert_non_null(mem_new_alloc(pool, 10));
+    }
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, num_allocs * 10, num_allocs, 1);
+    for (unsigned u = 0; u < num_allocs; u += 2) {
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_at(pool, u * 10)), ALLOC_OK);
+    }
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, num_allocs * 5, num_allocs / 2, num_allocs / 2 + 1);
+    for (unsigned u = 1; u < num_allocs; u += 2) {
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_at(pool, u * 10)), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    /*
+     * Prefaulted, locked, and reserved pool:
+     *
+     * 1. Reserve room for 2 x 200 + 1 segments. The node heap and the gap index never grow.
+     * 2. Allocate 200 x 10, free every other one, then the rest.
+     */
+
+    pool = mem_pool_open_ex(16 * 4096, BEST_FIT, POOL_PREFAULT | POOL_MLOCK);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_backing(pool), POOL_BACKING_MMAP);
+    assert_int_equal(mem_pool_reserve(pool, 2 * num_allocs + 1), ALLOC_OK);
+
+    alloc_pt allocs[200];
+    for (unsigned u = 0; u < num_allocs; u++) {
+        allocs[u] = mem_new_alloc(pool, 10);
+        assert_non_null(allocs[u]);
+    }
+    for (unsigned u = 0; u < num_allocs; u += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    check_metadata(pool, BEST_FIT, 16 * 4096, num_allocs * 5, num_allocs / 2, num_allocs / 2 + 1);
+    for (unsigned u = 1; u < num_allocs; u += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, POOL_PREFAULT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_backing(pool), POOL_BACKING_HEAP);
+    assert_int_equal(pool->mem[POOL_SIZE - 1], 0);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_remap(void **state) {
+    (void) state; /* unused */
+
+    const size_t page = 4096;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    /*
+     * Remapped pool:
+     *
+     * 1. Open a pool of 4 pages. Allocate 3 pages and write to them.
+     * 2. Allocate 3 pages. The pool is remapped to 8 pages, and the tail gap takes them.
+     * 3. Fill up the tail gap, then allocate 100. The pool is remapped to 16 pages,
+     *    and a new tail gap follows the last allocation.
+     */
+
+    // the pool moves when it is remapped, so it cannot be shared between threads
+    assert_null(mem_pool_open_ex(4 * page, FIRST_FIT, POOL_REMAP | POOL_LOCK_SPIN));
+    assert_null(mem_pool_open_ex(4 * page, FIRST_FIT, POOL_REMAP | POOL_LOCK_MUTEX));
+    assert_null(mem_pool_open_ex(4 * page, FIRST_FIT, POOL_REMAP | POOL_LOCK_MUTEX | POOL_THREAD_CACHE));
+
+    pool_pt pool = mem_pool_open_ex(4 * page, FIRST_FIT, POOL_REMAP);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_backing(pool), POOL_BACKING_MMAP);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 3 * page);
+    assert_non_null(alloc0);
+    memset(alloc0->mem, 'a', alloc0->size);
+    alloc_pt alloc1 = mem_new_alloc(pool, 3 * page);
+    assert_non_null(alloc1);
+
+    pool_segment_t exp0[3] =
+            {
+                    {3 * page, 1},
+                    {3 * page, 1},
+                    {2 * page, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, 8 * page, 6 * page, 2, 1);
+    assert_true(alloc0->mem == pool->mem);
+    assert_int_equal(alloc0->mem[3 * page - 1], 'a');
+
+    alloc_pt alloc2 = mem_new_alloc(pool, 2 * page);
+    assert_non_null(alloc2);
+    alloc_pt alloc3 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc3);
+
+    pool_segment_t exp1[5] =
+            {
+                    {3 * page, 1},
+                    {3 * page, 1},
+                    {2 * page, 1},
+                    {100, 1},
+                    {8 * page - 100, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, 16 * page, 8 * page + 100, 4, 1);
+    assert_int_equal(alloc0->mem[0], 'a');
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void *open_close_pools(void *arg) {
+    unsigned rounds = *(unsigned *) arg;
+
+    for (unsigned u = 0; u < rounds; u++) {
+        pool_pt pool = mem_pool_open(1000, (u % 2) ? BEST_FIT : FIRST_FIT);
+        if (pool == NULL) {
+            return (void *) 1;
+        }
+        alloc_pt alloc = mem_new_alloc(pool, 100);
+        if ((alloc == NULL)
+            || (mem_del_alloc(pool, alloc) != ALLOC_OK)
+            || (mem_pool_close(pool) != ALLOC_OK)) {
+            return (void *) 1;
+        }
+    }
+
+    return NULL;
+}
+
+static void test_pool_store_threads(void **state) {
+    (void) state; /* unused */
+
+    unsigned rounds = 500;
+    pthread_t threads[8];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // every thread opens and closes its own pools, all through the one pool store
+    for (unsigned u = 0; u < 8; u++) {
+        assert_int_equal(pthread_create(&threads[u], NULL, open_close_pools, &rounds), 0);
+    }
+    for (unsigned u = 0; u < 8; u++) {
+        void *result = NULL;
+        assert_int_equal(pthread_join(threads[u], &result), 0);
+        assert_null(result);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_CALLED_AGAIN);
+}
+
+static void *alloc_free_loop(void *arg) {
+    pool_pt pool = (pool_pt) arg;
+    alloc_pt allocs[16];
+
+    for (unsigned round = 0; round < 500; round++) {
+        for (unsigned u = 0; u < 16; u++) {
+            allocs[u] = mem_new_alloc(pool, 16 + (u * 7 + round) % 100);
+            if (allocs[u] == NULL) {
+                return (void *) 1;
+            }
+            allocs[u]->mem[0] = (char) u;
+        }
+        for (unsigned u = 0; u < 16; u++) {
+            if ((allocs[u]->mem[0] != (char) u) || (mem_del_alloc(pool, allocs[u]) != ALLOC_OK)) {
+                return (void *) 1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void test_pool_locked(void **state) {
+    (void) state; /* unused */
+
+    const unsigned lock_flags[2] = {POOL_LOCK_SPIN, POOL_LOCK_MUTEX};
+    pthread_t threads[4];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // several threads allocate from and free to the one pool, with each kind of lock
+    for (unsigned f = 0; f < 2; f++) {
+        pool_pt pool = mem_pool_open_ex(POOL_SIZE, BEST_FIT, lock_flags[f]);
+        assert_non_null(pool);
+        for (unsigned u = 0; u < 4; u++) {
+            assert_int_equal(pthread_create(&threads[u], NULL, alloc_free_loop, pool), 0);
+        }
+        for (unsigned u = 0; u < 4; u++) {
+            void *result = NULL;
+            assert_int_equal(pthread_join(threads[u], &result), 0);
+            assert_null(result);
+        }
+        check_metadata(pool, BEST_FIT, POOL_SIZE, 0, 0, 1);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void *alloc_free_flush(void *arg) {
+    void *result = alloc_free_loop(arg);
+
+    mem_thread_cache_flush((pool_pt) arg);
+
+    return result;
+}
+
+static void test_pool_thread_cache(void **state) {
+    (void) state; /* unused */
+
+    pthread_t threads[4];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    /*
+     * Thread cache:
+     *
+     * 1. Allocate 100. The bin for its size class is refilled in a batch of 8.
+     * 2. Free it. It stays in the cache, so the pool still counts it.
+     *    Freeing it again fails, and so does freeing a block of another pool.
+     * 3. Allocate 100 again. The same block comes back.
+     * 4. Flush the cache. All the blocks go back to the pool.
+     */
+
+    // the caches share the pool between threads, so it has to be locked
+    assert_null(mem_pool_open_ex(POOL_SIZE, FIRST_FIT, POOL_THREAD_CACHE));
+
+    // the cached blocks stay valid while the node heap grows under them
+    pool_pt pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, POOL_LOCK_MUTEX | POOL_THREAD_CACHE);
+    assert_non_null(pool);
+    alloc_pt cached[2];
+    alloc_pt aligned[64];
+    cached[0] = mem_new_alloc(pool, 100);
+    assert_non_null(cached[0]);
+    for (unsigned u = 0; u < 64; u++) {
+        aligned[u] = mem_new_alloc_aligned(pool, 10, 16);
+        assert_non_null(aligned[u]);
+    }
+    cached[1] = mem_new_alloc(pool, 100);
+    assert_non_null(cached[1]);
+    assert_int_equal(cached[1]->size, 100);
+    for (unsigned u = 0; u < 64; u++) {
+        assert_int_equal(mem_del_alloc(pool, aligned[u]), ALLOC_OK);
+    }
+    assert_int_equal(mem_del_alloc(pool, cached[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, cached[1]), ALLOC_OK);
+    assert_int_equal(mem_thread_cache_flush(pool), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, POOL_LOCK_MUTEX | POOL_THREAD_CACHE);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_size_classes(pool, 16, 256, 4), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->size, 112);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 8 * 112, 8, 1);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 8 * 112, 8, 1);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_FAIL);
+    pool_pt other = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(other);
+    alloc_pt foreign = mem_new_alloc(other, 100);
+    assert_non_null(foreign);
+    assert_int_equal(mem_del_alloc(pool, foreign), ALLOC_FAIL);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 8 * 112, 8, 1);
+    check_metadata(other, FIRST_FIT, POOL_SIZE, 100, 1, 1);
+    assert_int_equal(mem_del_alloc(other, foreign), ALLOC_OK);
+    assert_int_equal(mem_pool_close(other), ALLOC_OK);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    assert_true(alloc1 == alloc0);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    assert_int_equal(mem_thread_cache_flush(pool), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    // several threads, each with a cache of its own
+    for (unsigned u = 0; u < 4; u++) {
+        assert_int_equal(pthread_create(&threads[u], NULL, alloc_free_flush, pool), 0);
+    }
+    for (unsigned u = 0; u < 4; u++) {
+        void *result = NULL;
+        assert_int_equal(pthread_join(threads[u], &result), 0);
+        assert_null(result);
+    }
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void *slab_alloc_free_loop(void *arg) {
+    slab_pt slab = (slab_pt) arg;
+    unsigned *objects[8];
+
+    for (unsigned round = 0; round < 2000; round++) {
+        for (unsigned u = 0; u < 8; u++) {
+            objects[u] = (unsigned *) mem_slab_alloc(slab);
+            if (objects[u] == NULL) {
+                return (void *) 1;
+            }
+            *objects[u] = round;
+        }
+        for (unsigned u = 0; u < 8; u++) {
+            if ((*objects[u] != round) || (mem_slab_free(slab, objects[u]) != ALLOC_OK)) {
+                return (void *) 1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void test_pool_slab(void **state) {
+    (void) state; /* unused */
+
+    pthread_t threads[4];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // a remapped pool may move, and the objects with it
+    pool_pt remap_pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, POOL_REMAP);
+    assert_non_null(remap_pool);
+    assert_null(mem_slab_open(remap_pool, 20, 4));
+    assert_int_equal(mem_pool_close(remap_pool), ALLOC_OK);
+
+    // a mapped pool starts on a page, so the slab needs no padding in front
+    pool_pt pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, POOL_MMAP);
+    assert_non_null(pool);
+
+    // 4 objects of 20, rounded up to 32, carved out of the pool in one piece
+    slab_pt slab = mem_slab_open(pool, 20, 4);
+    assert_non_null(slab);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 128, 1, 1);
+
+    char *object0 = (char *) mem_slab_alloc(slab);
+    char *object1 = (char *) mem_slab_alloc(slab);
+    char *object2 = (char *) mem_slab_alloc(slab);
+    char *object3 = (char *) mem_slab_alloc(slab);
+    assert_non_null(object3);
+    assert_true(object1 == object0 + 32);
+    assert_int_equal((uintptr_t) object0 % 16, 0);
+    assert_null(mem_slab_alloc(slab));
+
+    // the last one freed is the first one handed out
+    assert_int_equal(mem_slab_free(slab, object1), ALLOC_OK);
+    assert_int_equal(mem_slab_free(slab, object2), ALLOC_OK);
+    assert_true(mem_slab_alloc(slab) == object2);
+    assert_int_equal(mem_slab_free(slab, object0 + 1), ALLOC_FAIL);
+    assert_int_equal(mem_slab_free(slab, object0), ALLOC_OK);
+    assert_int_equal(mem_slab_free(slab, object2), ALLOC_OK);
+    assert_int_equal(mem_slab_free(slab, object3), ALLOC_OK);
+
+    assert_int_equal(mem_slab_close(slab), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    // several threads on one slab, with no lock
+    slab = mem_slab_open(pool, sizeof(unsigned), 4 * 8);
+    assert_non_null(slab);
+    for (unsigned u = 0; u < 4; u++) {
+        assert_int_equal(pthread_create(&threads[u], NULL, slab_alloc_free_loop, slab), 0);
+    }
+    for (unsigned u = 0; u < 4; u++) {
+        void *result = NULL;
+        assert_int_equal(pthread_join(threads[u], &result), 0);
+        assert_null(result);
+    }
+    assert_int_equal(mem_slab_close(slab), ALLOC_OK);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+static void *alloc_one(void *arg) {
+    pool_pt pool = (pool_pt) arg;
+
+    return mem_new_alloc(pool, 100);
+}
+
+static void test_pool_sharded(void **state) {
+    (void) state; /* unused */
+
+    pthread_t threads[4];
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    assert_null(mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, 0));
+    assert_null(mem_pool_open_sharded(100, FIRST_FIT, 4));
+
+    // 4 slices of 249984, on cache lines, and the last one takes the rest
+    pool_pt pool = mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, 4);
+    assert_non_null(pool);
+    mem_inspect_pool(pool, &segs, &num_segs);
+    assert_int_equal(num_segs, 4);
+    assert_int_equal(segs[0].size, 249984);
+    assert_int_equal(segs[3].size, 250048);
+    free(segs);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 4);
+
+    // a thread allocates from its own shard, at the start of it
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+    assert_int_equal(mem_alloc_offset(pool, alloc0) % 249984, 0);
+    assert_true(alloc1->mem == alloc0->mem + 100);
+    assert_true(mem_alloc_at(pool, mem_alloc_offset(pool, alloc1)) == alloc1);
+    assert_null(mem_alloc_at(pool, POOL_SIZE));
+
+    // another thread gets the next shard, and its allocation is freed here
+    alloc_pt other = NULL;
+    assert_int_equal(pthread_create(&threads[0], NULL, alloc_one, pool), 0);
+    assert_int_equal(pthread_join(threads[0], (void **) &other), 0);
+    assert_non_null(other);
+    assert_int_equal(mem_alloc_offset(pool, other) % 249984, 0);
+    assert_true(other->mem != alloc0->mem);
+    mem_inspect_pool(pool, &segs, &num_segs);
+    free(segs);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 300, 3, 4);
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(pool, other), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, other), ALLOC_FAIL);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    mem_inspect_pool(pool, &segs, &num_segs);
+    free(segs);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 4);
+
+    // several threads at once, each in a shard of its own as long as there are enough
+    for (unsigned u = 0; u < 4; u++) {
+        assert_int_equal(pthread_create(&threads[u], NULL, alloc_free_loop, pool), 0);
+    }
+    for (unsigned u = 0; u < 4; u++) {
+        void *result = NULL;
+        assert_int_equal(pthread_join(threads[u], &result), 0);
+        assert_null(result);
+    }
+    mem_inspect_pool(pool, &segs, &num_segs);
+    assert_int_equal(num_segs, 4);
+    free(segs);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 4);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+typedef struct _handoff {
+    pool_pt pool;
+    alloc_pt alloc;
+    _Atomic(alloc_pt) slots[32];
+} handoff_t, *handoff_pt;
+
+static void *free_twice(void *arg) {
+    handoff_pt handoff = (handoff_pt) arg;
+
+    if ((mem_del_alloc(handoff->pool, handoff->alloc) != ALLOC_OK)
+        || (mem_del_alloc(handoff->pool, handoff->alloc) != ALLOC_FAIL)) {
+        return (void *) 1;
+    }
+
+    return NULL;
+}
+
+static void *produce_allocs(void *arg) {
+    handoff_pt handoff = (handoff_pt) arg;
+
+    for (unsigned u = 0; u < 5000; u++) {
+        alloc_pt alloc = mem_new_alloc(handoff->pool, 16 + u % 100);
+        if (alloc == NULL) {
+            return (void *) 1;
+        }
+        alloc->mem[0] = (char) u;
+        while (atomic_load(&handoff->slots[u % 32]) != NULL) {
+            sched_yield();
+        }
+        atomic_store(&handoff->slots[u % 32], alloc);
+    }
+
+    return NULL;
+}
+
+static void *consume_allocs(void *arg) {
+    handoff_pt handoff = (handoff_pt) arg;
+
+    for (unsigned u = 0; u < 5000; u++) {
+        alloc_pt alloc = NULL;
+        while ((alloc = atomic_exchange(&handoff->slots[u % 32], NULL)) == NULL) {
+            sched_yield();
+        }
+        if ((alloc->mem[0] != (char) u) || (mem_del_alloc(handoff->pool, alloc) != ALLOC_OK)) {
+            return (void *) 1;
+        }
+    }
+
+    return NULL;
+}
+
+static void test_pool_remote_free(void **state) {
+    (void) state; /* unused */
+
+    pthread_t threads[2];
+    handoff_t handoff;
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+    void *result = NULL;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, 2);
+    assert_non_null(pool);
+    memset(&handoff, 0, sizeof(handoff));
+    handoff.pool = pool;
+
+    // a thread that never allocated frees to the shard's queue, once
+    assert_int_equal(pthread_create(&threads[0], NULL, alloc_one, pool), 0);
+    assert_int_equal(pthread_join(threads[0], (void **) &handoff.alloc), 0);
+    assert_non_null(handoff.alloc);
+    char *mem = handoff.alloc->mem;
+    assert_int_equal(pthread_create(&threads[0], NULL, free_twice, &handoff), 0);
+    assert_int_equal(pthread_join(threads[0], &result), 0);
+    assert_null(result);
+    // the node heaps grow while the block waits in the queue
+    assert_int_equal(mem_pool_reserve(pool, 200), ALLOC_OK);
+
+    // threads take the shards in turn, the next one is on the other shard,
+    // and the one after that drains the queue before it allocates
+    alloc_pt other = NULL;
+    alloc_pt again = NULL;
+    assert_int_equal(pthread_create(&threads[0], NULL, alloc_one, pool), 0);
+    assert_int_equal(pthread_join(threads[0], (void **) &other), 0);
+    assert_int_equal(pthread_create(&threads[0], NULL, alloc_one, pool), 0);
+    assert_int_equal(pthread_join(threads[0], (void **) &again), 0);
+    assert_non_null(other);
+    assert_true(other->mem != mem);
+    assert_true(again->mem == mem);
+    assert_int_equal(mem_del_alloc(pool, other), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, again), ALLOC_OK);
+    mem_inspect_pool(pool, &segs, &num_segs);
+    free(segs);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 2);
+
+    // one thread allocates, another frees, both at once
+    assert_int_equal(pthread_create(&threads[0], NULL, produce_allocs, &handoff), 0);
+    assert_int_equal(pthread_create(&threads[1], NULL, consume_allocs, &handoff), 0);
+    for (unsigned u = 0; u < 2; u++) {
+        assert_int_equal(pthread_join(threads[u], &result), 0);
+        assert_null(result);
+    }
+    mem_inspect_pool(pool, &segs, &num_segs);
+    free(segs);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 2);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static atomic_int snapshot_writer_done;
+
+static void *alloc_free_by_offset(void *arg) {
+    pool_pt pool = (pool_pt) arg;
+    size_t offsets[200];
+
+    // the node heap grows under the snapshots, and the allocations are freed by offset
+    for (unsigned round = 0; round < 50; round++) {
+        for (unsigned u = 0; u < 200; u++) {
+            alloc_pt alloc = mem_new_alloc(pool, 16 + (u * 7 + round) % 100);
+            if (alloc == NULL) {
+                return (void *) 1;
+            }
+            offsets[u] = mem_alloc_offset(pool, alloc);
+        }
+        for (unsigned u = 0; u < 200; u++) {
+            if (mem_del_alloc(pool, mem_alloc_at(pool, offsets[(u * 13) % 200])) != ALLOC_OK) {
+                return (void *) 1;
+            }
+        }
+    }
+    atomic_store(&snapshot_writer_done, 1);
+
+    return NULL;
+}
+
+static void test_pool_snapshot(void **state) {
+    (void) state; /* unused */
+
+    pthread_t thread;
+    pool_t stats;
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, POOL_LOCK_SPIN);
+    assert_non_null(pool);
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+    // without writers, a snapshot is what inspection sees
+    assert_int_equal(mem_inspect_pool_snapshot(pool, &stats, &segs, &num_segs), ALLOC_OK);
+    pool_segment_t exp[3] = {
+            {100, 0},
+            {200, 1},
+            {POOL_SIZE - 300, 0}
+    };
+    assert_int_equal(num_segs, 3);
+    assert_memory_equal(segs, exp, sizeof(exp));
+    free(segs);
+    assert_int_equal(stats.num_allocs, 1);
+    assert_int_equal(stats.alloc_size, 200);
+    assert_int_equal(stats.num_gaps, 2);
+
+    // snapshots taken while another thread allocates are consistent, every one
+    atomic_store(&snapshot_writer_done, 0);
+    assert_int_equal(pthread_create(&thread, NULL, alloc_free_by_offset, pool), 0);
+    unsigned snapshots = 0;
+    while ((snapshots < 10) || !atomic_load(&snapshot_writer_done)) {
+        assert_int_equal(mem_inspect_pool_snapshot(pool, &stats, &segs, &num_segs), ALLOC_OK);
+        size_t total = 0;
+        size_t alloc_size = 0;
+        unsigned num_allocs = 0;
+        for (unsigned u = 0; u < num_segs; u++) {
+            total += segs[u].size;
+            if (segs[u].allocated) {
+                alloc_size += segs[u].size;
+                num_allocs++;
+            }
+        }
+        free(segs);
+        assert_int_equal(total, POOL_SIZE);
+        assert_int_equal(alloc_size, stats.alloc_size);
+        assert_int_equal(num_allocs, stats.num_allocs);
+        assert_int_equal(num_segs - num_allocs, stats.num_gaps);
+        snapshots++;
+    }
+    void *result = NULL;
+    assert_int_equal(pthread_join(thread, &result), 0);
+    assert_null(result);
+
+    assert_int_equal(mem_del_alloc(pool, mem_alloc_at(pool, 100)), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_shard_stealing(void **state) {
+    (void) state; /* unused */
+
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // 2 shards of 1024
+    pool_pt pool = mem_pool_open_sharded(2048, FIRST_FIT, 2);
+    assert_non_null(pool);
+
+    // the home shard fills up, and the next allocation comes from the other one
+    alloc_pt alloc0 = mem_new_alloc(pool, 1000);
+    assert_non_null(alloc0);
+    size_t home = mem_alloc_offset(pool, alloc0) / 1024;
+    alloc_pt alloc1 = mem_new_alloc(pool, 500);
+    assert_non_null(alloc1);
+    assert_int_equal(mem_alloc_offset(pool, alloc1), (1 - home) * 1024);
+    alloc_pt alloc2 = mem_new_alloc_zeroed(pool, 500);
+    assert_non_null(alloc2);
+    assert_int_equal(mem_alloc_offset(pool, alloc2), (1 - home) * 1024 + 500);
+    assert_int_equal(alloc2->mem[0], 0);
+
+    // neither shard has room left for this one
+    assert_null(mem_new_alloc(pool, 100));
+
+    // a stolen block goes back to the shard it came from
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    alloc1 = mem_new_alloc_aligned(pool, 800, 16);
+    assert_non_null(alloc1);
+    assert_int_equal(mem_alloc_offset(pool, alloc1), (1 - home) * 1024);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    mem_inspect_pool(pool, &segs, &num_segs);
+    free(segs);
+    check_metadata(pool, FIRST_FIT, 2048, 0, 0, 2);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void *open_close_loop(void *arg) {
+    (void) arg;
+
+    // each pool is visited, or not, by whatever pass runs while it is open
+    for (unsigned round = 0; round < 200; round++) {
+        pool_pt pool = mem_pool_open_ex(4096, FIRST_FIT, POOL_LOCK_SPIN);
+        if (pool == NULL) {
+            return (void *) 1;
+        }
+        alloc_pt alloc = mem_new_alloc(pool, 100);
+        if ((alloc == NULL) || (mem_del_alloc(pool, alloc) != ALLOC_OK)
+            || (mem_pool_close(pool) != ALLOC_OK)) {
+            return (void *) 1;
+        }
+    }
+
+    return NULL;
+}
+
+static void test_pool_maintenance(void **state) {
+    (void) state; /* unused */
+
+    const size_t big_size = 2 * 1024 * 1024;
+    pool_t stats;
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+
+    // a pass every millisecond
+    assert_int_equal(mem_init_ex(1), ALLOC_OK);
+    assert_int_equal(mem_init_ex(1), ALLOC_CALLED_AGAIN);
+
+    pool_pt pool = mem_pool_open_ex(4 * big_size, FIRST_FIT, POOL_MMAP | POOL_LOCK_SPIN);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_deferred_free(pool, 100), ALLOC_OK);
+    assert_int_equal(mem_pool_set_trim_threshold(pool, 1024 * 1024), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, big_size);
+    alloc_pt alloc2 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc2);
+    char *big = alloc1->mem;
+    memset(big, 0xff, big_size);
+
+    // the deferred frees are merged into one gap in the background,
+    // and then its pages are released
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    unsigned waited = 0;
+    do {
+        usleep(1000);
+        assert_int_equal(mem_inspect_pool_snapshot(pool, &stats, &segs, &num_segs), ALLOC_OK);
+        free(segs);
+    } while ((stats.num_gaps != 2) && (++waited < 5000));
+    assert_int_equal(stats.num_gaps, 2);
+    waited = 0;
+    while ((big[big_size / 2] != 0) && (++waited < 5000)) {
+        usleep(1000);
+    }
+    assert_int_equal(big[big_size / 2], 0);
+
+    // the settings change while the thread keeps visiting the pool
+    for (unsigned u = 0; u < 100; u++) {
+        assert_int_equal(mem_pool_set_deferred_free(pool, (u % 2) ? 10 : 100), ALLOC_OK);
+        assert_int_equal(mem_pool_set_size_classes(pool, (u % 2) ? 16 : 0, 256, 4), ALLOC_OK);
+        assert_int_equal(mem_pool_set_trim_threshold(pool, (u % 2) ? 4096 : 1024 * 1024), ALLOC_OK);
+        usleep(100);
+    }
+
+    // pools open and close while the thread runs, without waiting for its passes
+    pthread_t threads[2];
+    for (unsigned u = 0; u < 2; u++) {
+        assert_int_equal(pthread_create(&threads[u], NULL, open_close_loop, NULL), 0);
+    }
+    for (unsigned u = 0; u < 2; u++) {
+        void *result = NULL;
+        assert_int_equal(pthread_join(threads[u], &result), 0);
+        assert_null(result);
+    }
+
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // the thread stops with the library
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_striped(void **state) {
+    (void) state; /* unused */
+
+    pthread_t threads[4];
+    pool_t stats;
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    assert_null(mem_pool_open_striped(POOL_SIZE, FIRST_FIT, 0));
+    pool_pt pool = mem_pool_open_striped(POOL_SIZE, FIRST_FIT, 4);
+    assert_non_null(pool);
+
+    // a block allocated on another thread is freed straight into its stripe, not queued
+    alloc_pt other = NULL;
+    assert_int_equal(pthread_create(&threads[0], NULL, alloc_one, pool), 0);
+    assert_int_equal(pthread_join(threads[0], (void **) &other), 0);
+    assert_non_null(other);
+    assert_int_equal(mem_alloc_offset(pool, other) % 249984, 0);
+    assert_int_equal(mem_del_alloc(pool, other), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, other), ALLOC_FAIL);
+    assert_int_equal(mem_inspect_pool_snapshot(pool, &stats, &segs, &num_segs), ALLOC_OK);
+    free(segs);
+    assert_int_equal(num_segs, 4);
+    assert_int_equal(stats.num_allocs, 0);
+    assert_int_equal(stats.num_gaps, 4);
+
+    // several threads at once, each carving from whichever stripe is free
+    for (unsigned u = 0; u < 4; u++) {
+        assert_int_equal(pthread_create(&threads[u], NULL, alloc_free_loop, pool), 0);
+    }
+    for (unsigned u = 0; u < 4; u++) {
+        void *result = NULL;
+        assert_int_equal(pthread_join(threads[u], &result), 0);
+        assert_null(result);
+    }
+    mem_inspect_pool(pool, &segs, &num_segs);
+    assert_int_equal(num_segs, 4);
+    free(segs);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 4);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+static void test_pool_records_stay(void **state) {
+    (void) state; /* unused */
+
+    const unsigned lock_flags[3] = {0, POOL_LOCK_SPIN, POOL_LOCK_MUTEX};
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // the first record is still valid after enough allocations to grow the node heap twice
+    for (unsigned f = 0; f < 3; f++) {
+        pool_pt pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, lock_flags[f]);
+        assert_non_null(pool);
+        alloc_pt first = mem_new_alloc(pool, 100);
+        assert_non_null(first);
+        alloc_pt allocs[100];
+        for (unsigned u = 0; u < 100; u++) {
+            allocs[u] = mem_new_alloc(pool, 10);
+            assert_non_null(allocs[u]);
+        }
+        assert_ptr_equal(mem_alloc_at(pool, 0), first);
+        assert_int_equal(first->size, 100);
+        assert_int_equal(mem_del_alloc(pool, first), ALLOC_OK);
+        for (unsigned u = 0; u < 100; u++) {
+            assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+        }
+        check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+/*******************************************/
+/***         7. DRIVER ROUTINE           ***/
 /*******************************************/
 
 int run_test_suite() {
@@ -2443,8 +4053,33 @@ int run_test_suite() {
             cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
 
-            // do not uncomment until the project is changed to return the allocation address
-//            cmocka_unit_test(test_pool_stresstest),
+            cmocka_unit_test_setup_teardown(test_pool_aligned_alloc, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_zeroed_alloc, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_deferred_free, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_size_classes, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_near_alloc, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test(test_pool_mmap_backing),
+            cmocka_unit_test(test_pool_huge_pages),
+            cmocka_unit_test(test_pool_trim_gaps),
+            cmocka_unit_test(test_pool_file_backed),
+            cmocka_unit_test(test_pool_growable),
+            cmocka_unit_test(test_pool_external),
+            cmocka_unit_test(test_pool_shared),
+            cmocka_unit_test(test_pool_numa),
+            cmocka_unit_test(test_pool_prefault_reserve),
+            cmocka_unit_test(test_pool_remap),
+            cmocka_unit_test(test_pool_store_threads),
+            cmocka_unit_test(test_pool_locked),
+            cmocka_unit_test(test_pool_thread_cache),
+            cmocka_unit_test(test_pool_slab),
+            cmocka_unit_test(test_pool_sharded),
+            cmocka_unit_test(test_pool_remote_free),
+            cmocka_unit_test(test_pool_snapshot),
+            cmocka_unit_test(test_pool_shard_stealing),
+            cmocka_unit_test(test_pool_maintenance),
+            cmocka_unit_test(test_pool_striped),
+            cmocka_unit_test(test_pool_records_stay),
+            cmocka_unit_test(test_pool_stresstest),
     };
 
     return cmocka_run_group_tests_name("pool_test_suite", tests, NULL, NULL);